@@ -1,292 +1,1222 @@
-/*
- * 17_registro_estudiantes.c - Parte 3, Proyecto 17: Sistema de alumnos
- *
- * Este proyecto construye una aplicación con menú para gestionar registros
- * de alumnos. Demuestra cómo combinar structs, arrays, funciones y E/S de
- * ficheros para crear una herramienta con datos persistentes.
- *
- * Fecha: 15-06-2025
- * Autores:
- *   DunamisMax <github.com/dunamismax>
- *   Andrés Suárez <github.com/asuagar>
- *
- * SPDX-License-Identifier: MIT
- */
-
-/*
- * =============================================================================
- *                           - INICIO DE LA LECCIÓN -
- * =============================================================================
- *
- * Aquí es donde todo se une. Construiremos una aplicación completa que:
- * 1. Añade nuevos registros de alumnos.
- * 2. Muestra todos los registros existentes.
- * 3. Guarda los registros en un fichero para no perder datos al cerrar.
- * 4. Carga los registros del fichero al iniciar el programa.
- *
- * Este patrón es la base de muchas aplicaciones de gestión de datos.
- *
- * CONCEPTOS DE ARQUITECTURA CLAVE:
- * - MODULARIDAD: dividimos el programa en funciones pequeñas y específicas
- *   (por ej., `add_student`, `save_to_file`). Facilita lectura, depuración
- *   y mantenimiento. `main` actúa como centro de control.
- * - PERSISTENCIA: con E/S de ficheros, los datos persisten entre ejecuciones.
- * - INTERFAZ DE USUARIO: se usa un menú de texto sencillo.
- * - GESTIÓN DE ERRORES: el programa maneja con cuidado errores de fichero
- *   y entradas inválidas del usuario.
- */
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-
-/* --- Constantes globales y tipos --- */
-#define MAX_STUDENTS 100
-#define MAX_NAME_LEN 50
-#define FILENAME "students.db"
-
-/* Estructura principal para un alumno. */
-typedef struct {
-    int id;
-    char name[MAX_NAME_LEN];
-    double gpa;
-} Student;
-
-/* --- Prototipos --- */
-/*
- * Declaramos las funciones para tener una vista general y poder llamarlas
- * desde `main` antes de su definición.
- */
-void display_menu(void);
-void add_student(Student students[], int *count);
-void print_all_records(const Student students[], int count);
-void save_to_file(const Student students[], int count);
-void load_from_file(Student students[], int *count);
-void clear_input_buffer(void);
-
-/* --- Función principal: centro de control --- */
-int main(void) 
-{
-    Student all_students[MAX_STUDENTS];
-    int student_count = 0;
-    int choice = 0;
-
-    /* Cargar registros existentes del fichero de base de datos. */
-    load_from_file(all_students, &student_count);
-
-    /* Bucle principal de la aplicación. Termina cuando el usuario salga. */
-    while (1) {
-        display_menu();
-
-        /* Leer la opción del menú. */
-        if (scanf("%d", &choice) != 1) {
-            /* Si la entrada no es un número, manejar el error. */
-            printf("Invalid input. Please enter a number.\n");
-            clear_input_buffer();
-            continue;    /* Saltar resto del bucle y volver a empezar. */
-        }
-        clear_input_buffer();    /* Limpiar salto de línea pendiente. */
-
-        switch (choice) {
-        case 1:
-            add_student(all_students, &student_count);
-            break;
-        case 2:
-            print_all_records(all_students, student_count);
-            break;
-        case 3:
-            save_to_file(all_students, student_count);
-            break;
-        case 4:
-            printf("Exiting program. Goodbye!\n");
-            exit(0);    /* exit(0): finaliza con éxito. */
-        default:
-            printf("Invalid choice. Please try again.\n");
-        }
-
-        printf("\n");    /* Espacio de lectura antes del siguiente menú. */
-    }
-
-    /* Esta línea es técnicamente inalcanzable, pero es 
-     * buena práctica escribirla. 
-     */
-    return 0;
-}
-
-/* --- Implementaciones --- */
-
-/*
- * Muestra el menú principal al usuario.
- */
-void display_menu(void) 
-{
-    printf("--- Student Record System ---\n");
-    printf("1. Add Student\n");
-    printf("2. Display All Records\n");
-    printf("3. Save Records to File\n");
-    printf("4. Exit\n");
-    printf("Enter your choice: ");
-}
-
-/*
- * Limpia el búfer de entrada estándar para evitar problemas con scanf.
- */
-void clear_input_buffer(void) 
-{
-    int c;
-    while ((c = getchar()) != '\n' && c != EOF) {
-        /* Consumir caracteres hasta nueva línea o EOF. */
-    }
-}
-
-/*
- * Añade un nuevo registro de alumno al array.
- * param students: el vector de los registros de estudiantes
- * param count: puntuero al actual número de estudiante. El puntero
- *              permite modificar la variable original `student_count`
- */
-void add_student(Student students[], int *count) 
-{
-    if (*count >= MAX_STUDENTS) {
-        printf("Database is full. Cannot add more students.\n");
-        return;
-    }
-
-    printf("Enter Student ID: ");
-    scanf("%d", &students[*count].id);
-    clear_input_buffer();
-
-    printf("Enter Student Name: ");
-    /*
-     * Leer una línea completa (incluye espacios) hasta el límite de tamaño.
-     * `fgets` incluye el salto de línea; lo eliminamos.
-     */
-    fgets(students[*count].name, MAX_NAME_LEN, stdin);
-    students[*count].name[strcspn(students[*count].name, "\n")] = 0;
-
-    printf("Enter Student GPA: ");
-    scanf("%lf", &students[*count].gpa);
-    clear_input_buffer();
-
-    printf("Student added successfully.\n");
-    (*count)++;    /* Incrementar el número total de alumnos. */
-}
-
-/*
- * Imprime todos los registros en una tabla formateada.
- * param students: vector de estudiantes
- * param count: el número de estudiantes
- *              `const` indica que no se modifican los datos.
- */
-void print_all_records(const Student students[], int count) 
-{
-    if (count == 0) {
-        printf("No records to display.\n");
-        return;
-    }
-
-    printf("\n--- All Student Records ---\n");
-    printf("ID   | Name                                               | GPA\n");
-    printf("-----|----------------------------------------------------|-----\n");
-    for (int i = 0; i < count; i++) {
-        /*
-         * %-4d  : entero alineado a la izquierda en 4 espacios
-         * %-50s : cadena alineada a la izquierda en 50 espacios
-         * %5.2f : double alineado a la derecha en 5 espacios con 2 decimales
-         */
-        printf("%-4d | %-50s | %5.2f\n",
-               students[i].id, students[i].name, students[i].gpa);
-    }
-    printf("----------------------------------------------------------------\n");
-}
-
-/*
- * Guarda todo el array de alumnos en un fichero.
- */
-void save_to_file(const Student students[], int count) 
-{
-    /*
-     * "w" para escribir; sobrescribe si existe.
-     */
-    FILE *file = fopen(FILENAME, "w");
-    if (file == NULL) {
-        fprintf(stderr,
-                "Error: Could not open file '%s' for writing.\n",
-                FILENAME);
-        return;
-    }
-
-    for (int i = 0; i < count; i++) {
-        /*
-         * Guardamos en formato CSV (valores separados por coma).
-         * Es un formato sencillo y común.
-         */
-        fprintf(file, "%d,%s,%.2f\n",
-                students[i].id, students[i].name, students[i].gpa);
-    }
-
-    fclose(file);
-    printf("Successfully saved %d record(s) to %s.\n", count, FILENAME);
-}
-
-/*
- * Carga registros de alumnos desde un fichero al array.
- */
-void load_from_file(Student students[], int *count) 
-{
-    /* "r" para lectura. */
-    FILE *file = fopen(FILENAME, "r");
-    if (file == NULL) {
-        /*
-         * Si es la primera ejecución, no es un error que no exista.
-         */
-        printf("No existing database file found. Starting fresh.\n");
-        return;
-    }
-
-    /*
-     * `fscanf` devuelve el número de elementos leídos con éxito (esperamos 3).
-     * El especificador `[^,]` lee hasta la coma. Limitamos a 49 chars.
-     */
-    while (*count < MAX_STUDENTS &&
-           fscanf(file, "%d,%49[^,],%lf\n",
-                  &students[*count].id,
-                  students[*count].name,
-                  &students[*count].gpa) == 3) {
-        (*count)++;
-    }
-
-    fclose(file);
-    printf("Successfully loaded %d record(s) from %s.\n",
-           *count, FILENAME);
-}
-
-/*
- * =============================================================================
- *                            - FIN DE LA LECCIÓN -
- * =============================================================================
- *
- * ¡Enhorabuena! Has construido una aplicación completa de base de datos.
- * Este proyecto es un hito: demuestra un dominio sólido de las funciones
- * clave de C para software práctico.
- *
- * Logros del proyecto:
- * 
- * - Diseño modular con funciones por característica.
- * - Almacenamiento persistente en un fichero CSV sencillo.
- * - Menú interactivo limpio para controlar el programa.
- * - Gestión robusta de entrada del usuario y operaciones de sistema de ficheros.
- *
- * CÓMO COMPILAR Y EJECUTAR:
- * 
- * 1) Abre una terminal.
- * 2) Ve al directorio del fichero.
- * 3) Compila:
- *    gcc -Wall -Wextra -std=c11 -o registro 17_registro_estudiantes.c
- * 4) Ejecuta:
- *    Linux/macOS: ./registro
- *    Windows:     registro.exe
- *
- * Prueba a añadir alumnos, guardar, salir y volver a ejecutar.
- * Verás cómo los registros se cargan automáticamente.
- */
+/*
+ * 17_registro_estudiantes.c - Parte 3, Proyecto 17: Sistema de alumnos
+ *
+ * Este proyecto construye una aplicación con menú para gestionar registros
+ * de alumnos. Demuestra cómo combinar structs, arrays, funciones y E/S de
+ * ficheros para crear una herramienta con datos persistentes.
+ *
+ * Fecha: 15-06-2025
+ * Autores:
+ *   DunamisMax <github.com/dunamismax>
+ *   Andrés Suárez <github.com/asuagar>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * =============================================================================
+ *                           - INICIO DE LA LECCIÓN -
+ * =============================================================================
+ *
+ * Aquí es donde todo se une. Construiremos una aplicación completa que:
+ * 1. Añade nuevos registros de alumnos.
+ * 2. Muestra todos los registros existentes.
+ * 3. Guarda los registros en un fichero para no perder datos al cerrar.
+ * 4. Carga los registros del fichero al iniciar el programa.
+ *
+ * Este patrón es la base de muchas aplicaciones de gestión de datos.
+ *
+ * CONCEPTOS DE ARQUITECTURA CLAVE:
+ * - MODULARIDAD: dividimos el programa en funciones pequeñas y específicas
+ *   (por ej., `add_student`, `save_to_file`). Facilita lectura, depuración
+ *   y mantenimiento. `main` actúa como centro de control.
+ * - PERSISTENCIA: con E/S de ficheros, los datos persisten entre ejecuciones.
+ * - INTERFAZ DE USUARIO: se usa un menú de texto sencillo.
+ * - GESTIÓN DE ERRORES: el programa maneja con cuidado errores de fichero
+ *   y entradas inválidas del usuario.
+ *
+ * ALMACÉN POR COLUMNAS (STRUCT OF ARRAYS):
+ * Lo natural sería un array de `Student`, cada uno con su `id`, su nombre
+ * (50 bytes fijos) y su `gpa` juntos en memoria (ARRAY OF STRUCTS). Tiene
+ * dos problemas:
+ * - Un array fijo en la pila impone un máximo: el alumno 101 no cabe.
+ * - Para recorrer solo las notas (la media, por ejemplo) la CPU trae a la
+ *   caché el registro entero, unos 64 bytes, para usar 8 de ellos.
+ *
+ * Por eso guardamos cada campo en su propio array dinámico (una COLUMNA):
+ *
+ *   ids:          [ 1 ][ 2 ][ 7 ] ...
+ *   gpas:         [3.5][2.9][3.8] ...
+ *   name_offsets: [ 0 ][ 4 ][ 10] ...  -> posición en `names`
+ *   names:        "Ana\0Berta\0Luis\0..."  (montón de cadenas)
+ *
+ * El alumno `i` es la fila `i` de todas las columnas. Recorrer las notas
+ * lee memoria contigua y solo notas: 8 alumnos por línea de caché en vez
+ * de uno. Los nombres, de longitud variable, van seguidos en un único
+ * bloque y cada fila guarda dónde empieza el suyo (un desplazamiento y no
+ * un puntero, porque el bloque se mueve al crecer).
+ *
+ * Cuando una columna se llena la hacemos crecer al DOBLE con `realloc`
+ * (crecimiento geométrico): así añadir un alumno cuesta O(1) amortizado
+ * y no hay límite fijo más allá de la memoria disponible.
+ *
+ * UN FICHERO BINARIO QUE NO HAY QUE LEER (`mmap`):
+ * Guardar en texto (CSV) obliga a convertir cada número al escribir y a
+ * interpretarlo de nuevo al leer: con millones de alumnos el programa
+ * tarda en arrancar, la nota se redondea a 2 decimales y un nombre con
+ * una coma rompe la lectura. `students.db` guarda en cambio las columnas
+ * tal como están en memoria:
+ *
+ *   +-------------+------------+-------------+------------------+--------+
+ *   | cabecera    | ids        | gpas        | name_offsets     | names  |
+ *   | (64 bytes)  | 4 B x n    | 8 B x n     | 8 B x n          | montón |
+ *   +-------------+------------+-------------+------------------+--------+
+ *
+ * La cabecera lleva una firma ("STUDENTS"), un número de VERSIÓN (para
+ * poder cambiar el formato sin confundir ficheros viejos), el número de
+ * alumnos y dónde empieza cada sección. Al arrancar, `mmap` PROYECTA el
+ * fichero en memoria y las columnas de la tabla apuntan directamente a
+ * él: no se lee ni se convierte nada, así que arrancar cuesta lo mismo
+ * con 10 alumnos que con 10 millones (el sistema trae cada página del
+ * disco cuando se toca). Solo al añadir el primer alumno se copian las
+ * columnas a memoria propia para poder hacerlas crecer.
+ *
+ * Para guardar se escribe un fichero temporal y se RENOMBRA sobre el
+ * original (`rename` es atómico): si el programa se corta a medias, el
+ * fichero anterior sigue intacto. El CSV queda solo para importar y
+ * exportar datos a otros programas.
+ *
+ * BUSCAR POR ID EN O(1): UN ÍNDICE HASH
+ * Para encontrar a un alumno por su `id` habría que recorrer la columna
+ * entera: con 10 millones, 10 millones de comparaciones. Un ÍNDICE es
+ * una estructura aparte que responde "¿en qué fila está el id X?" sin
+ * recorrer nada. Usamos una TABLA HASH con DIRECCIONAMIENTO ABIERTO:
+ *
+ *   huecos:  [   ][7 -> fila 2][   ][1 -> fila 0][2 -> fila 1][   ] ...
+ *
+ * Una función hash convierte el id en la posición de su hueco. Si está
+ * ocupado por otro id (una COLISIÓN), se prueba el siguiente, y así
+ * hasta dar con el id o con un hueco libre (SONDEO LINEAL). Mientras la
+ * tabla esté llena como mucho en 3/4 partes, las rachas de huecos
+ * ocupados son cortas y buscar cuesta O(1) de media. El número de huecos
+ * es una potencia de 2, así que al pasar de 3/4 se duplica y se vuelven
+ * a colocar todos (como las columnas, O(1) amortizado por alta).
+ *
+ * Con el índice, añadir rechaza ids repetidos, y buscar, modificar y
+ * borrar cuestan O(1). Para borrar sin desplazar filas, la última ocupa
+ * el hueco de la borrada. El índice no se guarda en el fichero: se
+ * construye la primera vez que hace falta, así que arrancar sigue
+ * siendo instantáneo.
+ */
+
+#define _POSIX_C_SOURCE 200809L /* Para mmap, fsync y getline con -std=c11 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>    /* Enteros de tamaño fijo para el formato */
+#include <fcntl.h>     /* open */
+#include <unistd.h>    /* close, fsync */
+#include <sys/mman.h>  /* mmap, munmap */
+#include <sys/stat.h>  /* fstat */
+
+/* --- Constantes globales y tipos --- */
+#define MAX_NAME_LEN 50             /* Tope de un nombre, con su '\0' */
+#define INITIAL_CAPACITY 16         /* Filas reservadas la primera vez */
+#define FILENAME "students.db"
+#define TEMP_FILENAME "students.db.tmp"
+#define DB_MAGIC "STUDENTS"         /* Firma: 8 bytes, sin el '\0' */
+#define DB_VERSION 1
+#define INDEX_MIN_BITS 4            /* El índice empieza con 2^4 huecos */
+#define NO_ROW ((size_t)-1)         /* "No encontrado" al buscar una fila */
+
+/*
+ * Hueco del índice por id. Guarda una copia del id para comparar sin ir
+ * a la columna, y la fila MÁS UNO, para que `row == 0` signifique hueco
+ * libre (y `calloc` deje todo el índice vacío).
+ */
+typedef struct {
+    int32_t id;
+    size_t row;
+} IndexSlot;
+
+/*
+ * Tabla de alumnos guardada por columnas. La fila `i` es el alumno `i`:
+ * `ids[i]`, `gpas[i]` y el nombre que empieza en `names + name_offsets[i]`.
+ * Recién cargada, las columnas apuntan al fichero proyectado (`map`).
+ */
+typedef struct {
+    int32_t *ids;
+    double *gpas;
+    uint64_t *name_offsets;
+    size_t count;          /* Alumnos guardados */
+    size_t capacity;       /* Filas reservadas en cada columna */
+    char *names;           /* Montón de nombres terminados en '\0' */
+    size_t names_len;
+    size_t names_capacity;
+    size_t names_dead;     /* Bytes de nombres borrados o sustituidos */
+    void *map;             /* Fichero proyectado, o NULL */
+    size_t map_size;
+    IndexSlot *index;      /* Índice por id; NULL hasta que hace falta */
+    size_t index_capacity; /* Huecos: 2^index_bits */
+    int index_bits;
+} StudentTable;
+
+/*
+ * Cabecera de `students.db` (64 bytes). Los desplazamientos se cuentan
+ * desde el inicio del fichero; los números van en el orden de bytes de
+ * la máquina, así que el fichero no se comparte entre arquitecturas.
+ */
+typedef struct {
+    char magic[8];                 /* DB_MAGIC */
+    uint32_t version;              /* DB_VERSION */
+    uint32_t header_size;          /* sizeof(DbHeader) */
+    uint64_t count;                /* Número de alumnos */
+    uint64_t ids_offset;           /* int32_t x count */
+    uint64_t gpas_offset;          /* double x count */
+    uint64_t name_offsets_offset;  /* uint64_t x count */
+    uint64_t names_offset;         /* Montón de nombres */
+    uint64_t names_len;
+} DbHeader;
+
+_Static_assert(sizeof(DbHeader) == 64, "la cabecera ocupa 64 bytes");
+
+/* --- Prototipos --- */
+/*
+ * Declaramos las funciones para tener una vista general y poder llamarlas
+ * desde `main` antes de su definición.
+ */
+void display_menu(void);
+void *grow_array(void *array, size_t count, size_t size);
+void table_detach(StudentTable *table);
+uint64_t table_store_name(StudentTable *table, const char *name);
+void table_append(StudentTable *table, int id, const char *name, double gpa);
+const char *table_name(const StudentTable *table, size_t row);
+double average_gpa(const StudentTable *table);
+void table_free(StudentTable *table);
+size_t index_home(int32_t id, int bits);
+size_t index_probe(const StudentTable *table, int32_t id);
+size_t index_rebuild(StudentTable *table, int bits);
+void index_remove(StudentTable *table, size_t slot);
+size_t table_find(StudentTable *table, int id);
+void table_set_name(StudentTable *table, size_t row, const char *name);
+void table_set_gpa(StudentTable *table, size_t row, double gpa);
+int table_delete(StudentTable *table, int id);
+void table_compact_names(StudentTable *table);
+int read_id(int *id);
+void add_student(StudentTable *table);
+void print_student(const StudentTable *table, size_t row);
+void print_all_records(const StudentTable *table);
+void find_student(StudentTable *table);
+void update_student(StudentTable *table);
+void delete_student(StudentTable *table);
+int write_section(FILE *file, uint64_t *pos, uint64_t offset,
+                  const void *data, size_t size);
+int save_to_file(const StudentTable *table);
+int section_fits(uint64_t offset, uint64_t count, uint64_t width,
+                 uint64_t size);
+void load_from_file(StudentTable *table);
+int import_csv(StudentTable *table, const char *path);
+int export_csv(const StudentTable *table, const char *path);
+int read_filename(const char *prompt, char *path, size_t size);
+int parse_id(const char *text, int *id);
+int parse_gpa(const char *text, double *gpa);
+void clip_name(char *name);
+int run_cli(StudentTable *table, int argc, char *argv[]);
+void clear_input_buffer(void);
+
+/* --- Función principal: centro de control --- */
+int main(int argc, char *argv[]) 
+{
+    StudentTable students = {0};    /* Vacía: crece al añadir */
+    int choice = 0;
+    char path[256];
+
+    /* Cargar registros existentes del fichero de base de datos. */
+    load_from_file(&students);
+
+    /* Con argumentos, se ejecuta una sola orden sin menú. */
+    if (argc > 1) {
+        int status = run_cli(&students, argc, argv);
+        table_free(&students);
+        return status;
+    }
+
+    /* Bucle principal de la aplicación. Termina cuando el usuario salga. */
+    while (1) {
+        display_menu();
+
+        /* Leer la opción del menú. */
+        if (scanf("%d", &choice) != 1) {
+            /* Si la entrada no es un número, manejar el error. */
+            printf("Invalid input. Please enter a number.\n");
+            clear_input_buffer();
+            continue;    /* Saltar resto del bucle y volver a empezar. */
+        }
+        clear_input_buffer();    /* Limpiar salto de línea pendiente. */
+
+        switch (choice) {
+        case 1:
+            add_student(&students);
+            break;
+        case 2:
+            print_all_records(&students);
+            break;
+        case 3:
+            find_student(&students);
+            break;
+        case 4:
+            update_student(&students);
+            break;
+        case 5:
+            delete_student(&students);
+            break;
+        case 6:
+            save_to_file(&students);
+            break;
+        case 7:
+            if (read_filename("CSV file to import: ", path, sizeof(path)))
+                import_csv(&students, path);
+            break;
+        case 8:
+            if (read_filename("CSV file to export: ", path, sizeof(path)))
+                export_csv(&students, path);
+            break;
+        case 9:
+            printf("Exiting program. Goodbye!\n");
+            table_free(&students);
+            exit(0);    /* exit(0): finaliza con éxito. */
+        default:
+            printf("Invalid choice. Please try again.\n");
+        }
+
+        printf("\n");    /* Espacio de lectura antes del siguiente menú. */
+    }
+
+    /* Esta línea es técnicamente inalcanzable, pero es 
+     * buena práctica escribirla. 
+     */
+    return 0;
+}
+
+/* --- Implementaciones --- */
+
+/*
+ * Muestra el menú principal al usuario.
+ */
+void display_menu(void) 
+{
+    printf("--- Student Record System ---\n");
+    printf("1. Add Student\n");
+    printf("2. Display All Records\n");
+    printf("3. Find Student\n");
+    printf("4. Update Student\n");
+    printf("5. Delete Student\n");
+    printf("6. Save Records to File\n");
+    printf("7. Import Records from CSV\n");
+    printf("8. Export Records to CSV\n");
+    printf("9. Exit\n");
+    printf("Enter your choice: ");
+}
+
+/*
+ * Limpia el búfer de entrada estándar para evitar problemas con scanf.
+ */
+void clear_input_buffer(void) 
+{
+    int c;
+    while ((c = getchar()) != '\n' && c != EOF) {
+        /* Consumir caracteres hasta nueva línea o EOF. */
+    }
+}
+
+/*
+ * Redimensiona un array dinámico a `count` elementos de `size` bytes.
+ * Si no hay memoria no se puede seguir: avisamos y terminamos.
+ */
+void *grow_array(void *array, size_t count, size_t size)
+{
+    void *grown = realloc(array, count * size);
+    if (grown == NULL) {
+        perror("realloc failed");
+        exit(1);
+    }
+    return grown;
+}
+
+/*
+ * Copia a memoria propia las columnas que apuntan al fichero proyectado
+ * y deshace la proyección. Hace falta antes del primer cambio: la
+ * proyección es de solo lectura y no se puede agrandar con `realloc`.
+ */
+void table_detach(StudentTable *table)
+{
+    if (table->map == NULL)
+        return;
+
+    size_t capacity = table->count > INITIAL_CAPACITY ? table->count
+                                                      : INITIAL_CAPACITY;
+    int32_t *ids = grow_array(NULL, capacity, sizeof(int32_t));
+    double *gpas = grow_array(NULL, capacity, sizeof(double));
+    uint64_t *name_offsets = grow_array(NULL, capacity, sizeof(uint64_t));
+    char *names = grow_array(NULL, table->names_len + 1, 1);
+    memcpy(ids, table->ids, table->count * sizeof(int32_t));
+    memcpy(gpas, table->gpas, table->count * sizeof(double));
+    memcpy(name_offsets, table->name_offsets,
+           table->count * sizeof(uint64_t));
+    memcpy(names, table->names, table->names_len);
+
+    munmap(table->map, table->map_size);
+    table->map = NULL;
+    table->map_size = 0;
+    table->ids = ids;
+    table->gpas = gpas;
+    table->name_offsets = name_offsets;
+    table->capacity = capacity;
+    table->names = names;
+    table->names_capacity = table->names_len + 1;
+}
+
+/*
+ * Copia un nombre al final del montón (que se duplica si no cabe) y
+ * devuelve dónde empieza.
+ */
+uint64_t table_store_name(StudentTable *table, const char *name)
+{
+    size_t len = strlen(name) + 1;    /* Con su '\0' */
+    if (table->names_len + len > table->names_capacity) {
+        size_t capacity = table->names_capacity ? table->names_capacity
+                                                : INITIAL_CAPACITY * 16;
+        while (capacity < table->names_len + len)
+            capacity *= 2;
+        table->names = grow_array(table->names, capacity, 1);
+        table->names_capacity = capacity;
+    }
+    memcpy(table->names + table->names_len, name, len);
+
+    uint64_t offset = table->names_len;
+    table->names_len += len;
+    return offset;
+}
+
+/*
+ * Añade un alumno al final de la tabla. Las columnas y el montón de
+ * nombres se duplican cuando se llenan. Si el índice ya existe, se le
+ * añade la fila nueva. No comprueba si el id está repetido: eso lo hace
+ * quien llama, con `table_find`.
+ */
+void table_append(StudentTable *table, int id, const char *name, double gpa)
+{
+    table_detach(table);
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2
+                                          : INITIAL_CAPACITY;
+        table->ids = grow_array(table->ids, capacity, sizeof(int32_t));
+        table->gpas = grow_array(table->gpas, capacity, sizeof(double));
+        table->name_offsets = grow_array(table->name_offsets, capacity,
+                                         sizeof(uint64_t));
+        table->capacity = capacity;
+    }
+
+    size_t row = table->count++;
+    table->ids[row] = id;
+    table->gpas[row] = gpa;
+    table->name_offsets[row] = table_store_name(table, name);
+
+    if (table->index == NULL)
+        return;
+    if (table->count * 4 > table->index_capacity * 3) {
+        index_rebuild(table, table->index_bits + 1); /* Ya incluye la fila */
+    } else {
+        size_t slot = index_probe(table, id);
+        table->index[slot].id = id;
+        table->index[slot].row = row + 1;
+    }
+}
+
+/*
+ * Devuelve el nombre del alumno de la fila `row`. El montón termina en
+ * '\0', así que basta con que el desplazamiento caiga dentro; si no (un
+ * fichero dañado), se devuelve "?" en vez de leer fuera.
+ */
+const char *table_name(const StudentTable *table, size_t row)
+{
+    uint64_t offset = table->name_offsets[row];
+    return offset < table->names_len ? table->names + offset : "?";
+}
+
+/*
+ * Nota media de todos los alumnos. Solo recorre la columna `gpas`:
+ * memoria contigua que la CPU lee por adelantado sin tocar ids ni nombres.
+ */
+double average_gpa(const StudentTable *table)
+{
+    if (table->count == 0)
+        return 0.0;
+    double sum = 0.0;
+    for (size_t i = 0; i < table->count; i++)
+        sum += table->gpas[i];
+    return sum / table->count;
+}
+
+/* Libera las columnas (o deshace la proyección) y deja la tabla vacía. */
+void table_free(StudentTable *table)
+{
+    if (table->map != NULL) {
+        munmap(table->map, table->map_size);
+    } else {
+        free(table->ids);
+        free(table->gpas);
+        free(table->name_offsets);
+        free(table->names);
+    }
+    free(table->index);
+    *table = (StudentTable){0};
+}
+
+/*
+ * Hueco inicial de `id` en un índice de 2^bits huecos (hash de
+ * Fibonacci): se multiplica por 2^64 / φ y se toman los bits ALTOS del
+ * producto, que dependen de todos los del id. Así, ids consecutivos
+ * quedan repartidos y no en una sola racha.
+ */
+size_t index_home(int32_t id, int bits)
+{
+    uint64_t hash = (uint64_t)(uint32_t)id * 0x9E3779B97F4A7C15u;
+    return (size_t)(hash >> (64 - bits));
+}
+
+/*
+ * Sondeo lineal: devuelve el hueco donde está `id` o, si no está, el
+ * hueco libre donde iría. Siempre hay huecos libres (ocupación <= 3/4),
+ * así que el bucle termina.
+ */
+size_t index_probe(const StudentTable *table, int32_t id)
+{
+    size_t mask = table->index_capacity - 1;
+    size_t slot = index_home(id, table->index_bits);
+    while (table->index[slot].row != 0 && table->index[slot].id != id)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+/*
+ * Crea un índice vacío de 2^bits huecos y mete en él todas las filas.
+ * Devuelve cuántas tenían un id ya visto: solo pasa con ficheros de
+ * antes del índice, y de esas filas solo la primera se puede buscar.
+ */
+size_t index_rebuild(StudentTable *table, int bits)
+{
+    free(table->index);
+    table->index_capacity = (size_t)1 << bits;
+    table->index_bits = bits;
+    table->index = calloc(table->index_capacity, sizeof(IndexSlot));
+    if (table->index == NULL) {
+        perror("calloc failed");
+        exit(1);
+    }
+
+    size_t duplicates = 0;
+    for (size_t row = 0; row < table->count; row++) {
+        size_t slot = index_probe(table, table->ids[row]);
+        if (table->index[slot].row != 0) {
+            duplicates++;
+            continue;
+        }
+        table->index[slot].id = table->ids[row];
+        table->index[slot].row = row + 1;
+    }
+    return duplicates;
+}
+
+/*
+ * Vacía un hueco del índice. No basta con marcarlo libre: una búsqueda
+ * pararía en él y no vería los ids que, por colisión, quedaron detrás
+ * en la misma racha. Por eso se recorre la racha y cada id que pueda
+ * ocupar el hueco (porque su hueco inicial no cae entre el hueco y él)
+ * se mueve hacia atrás, dejando libre el suyo.
+ */
+void index_remove(StudentTable *table, size_t slot)
+{
+    size_t mask = table->index_capacity - 1;
+    size_t next = slot;
+    while (1) {
+        next = (next + 1) & mask;
+        if (table->index[next].row == 0)
+            break;
+        size_t home = index_home(table->index[next].id, table->index_bits);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            table->index[slot] = table->index[next];
+            slot = next;
+        }
+    }
+    table->index[slot].row = 0;
+}
+
+/*
+ * Devuelve la fila del alumno `id`, o NO_ROW si no existe. La primera
+ * vez construye el índice con todas las filas (O(n)); a partir de ahí
+ * cada búsqueda es O(1).
+ */
+size_t table_find(StudentTable *table, int id)
+{
+    if (table->index == NULL) {
+        int bits = INDEX_MIN_BITS;
+        while (((size_t)1 << bits) * 3 < table->count * 4)
+            bits++;
+        size_t duplicates = index_rebuild(table, bits);
+        if (duplicates > 0)
+            printf("Warning: %zu record(s) repeat an earlier ID; "
+                   "only the first of each can be found.\n", duplicates);
+    }
+    const IndexSlot *slot = &table->index[index_probe(table, id)];
+    return slot->row != 0 ? slot->row - 1 : NO_ROW;
+}
+
+/*
+ * Cambia el nombre de una fila. El nuevo va al final del montón y el
+ * viejo se queda como espacio muerto hasta la próxima compactación.
+ */
+void table_set_name(StudentTable *table, size_t row, const char *name)
+{
+    table_detach(table);
+    table->names_dead += strlen(table_name(table, row)) + 1;
+    table->name_offsets[row] = table_store_name(table, name);
+    table_compact_names(table);
+}
+
+/* Cambia la nota de una fila. */
+void table_set_gpa(StudentTable *table, size_t row, double gpa)
+{
+    table_detach(table);
+    table->gpas[row] = gpa;
+}
+
+/*
+ * Borra al alumno `id` en O(1): la última fila pasa a ocupar la suya,
+ * así no hay que desplazar las demás (a cambio, el orden cambia).
+ * Devuelve 1 si existía y 0 si no.
+ */
+int table_delete(StudentTable *table, int id)
+{
+    size_t row = table_find(table, id);
+    if (row == NO_ROW)
+        return 0;
+
+    table_detach(table);
+    table->names_dead += strlen(table_name(table, row)) + 1;
+    index_remove(table, index_probe(table, id));
+
+    size_t last = --table->count;
+    if (row != last) {
+        table->ids[row] = table->ids[last];
+        table->gpas[row] = table->gpas[last];
+        table->name_offsets[row] = table->name_offsets[last];
+        /* Actualizar el índice de la fila movida (si es la indexada). */
+        size_t slot = index_probe(table, table->ids[row]);
+        if (table->index[slot].row == last + 1)
+            table->index[slot].row = row + 1;
+    }
+    table_compact_names(table);
+    return 1;
+}
+
+/*
+ * Cuando los nombres muertos ocupan más de la mitad del montón, se hace
+ * uno nuevo solo con los vivos. Cuesta O(n), pero antes hubo que borrar
+ * o cambiar del orden de n nombres, así que sale a O(1) amortizado.
+ */
+void table_compact_names(StudentTable *table)
+{
+    if (table->names_dead * 2 <= table->names_len)
+        return;
+
+    size_t size = 1;
+    for (size_t row = 0; row < table->count; row++)
+        size += strlen(table_name(table, row)) + 1;
+
+    char *names = grow_array(NULL, size, 1);
+    size_t len = 0;
+    for (size_t row = 0; row < table->count; row++) {
+        const char *name = table_name(table, row);
+        size_t name_len = strlen(name) + 1;
+        memcpy(names + len, name, name_len);
+        table->name_offsets[row] = len;
+        len += name_len;
+    }
+    free(table->names);
+    table->names = names;
+    table->names_len = len;
+    table->names_capacity = size;
+    table->names_dead = 0;
+}
+
+/*
+ * Pide un id por teclado. Devuelve 0 (y avisa) si no es un número.
+ */
+int read_id(int *id)
+{
+    printf("Enter Student ID: ");
+    int ok = scanf("%d", id) == 1;
+    clear_input_buffer();
+    if (!ok)
+        printf("Invalid ID.\n");
+    return ok;
+}
+
+/*
+ * Pide los datos de un alumno y lo añade a la tabla.
+ * param table: puntero a la tabla; el puntero permite que crezca y
+ *              modificar la variable original `students` de `main`
+ */
+void add_student(StudentTable *table) 
+{
+    int id = 0;
+    char name[MAX_NAME_LEN] = "";
+    double gpa = 0.0;
+
+    if (!read_id(&id))
+        return;
+    /* El índice dice al momento si el id ya está en uso. */
+    if (table_find(table, id) != NO_ROW) {
+        printf("A student with ID %d already exists.\n", id);
+        return;
+    }
+
+    printf("Enter Student Name: ");
+    /*
+     * Leer una línea completa (incluye espacios) hasta el límite de tamaño.
+     * `fgets` incluye el salto de línea; lo eliminamos.
+     */
+    if (fgets(name, MAX_NAME_LEN, stdin) != NULL)
+        name[strcspn(name, "\n")] = 0;
+
+    printf("Enter Student GPA: ");
+    scanf("%lf", &gpa);
+    clear_input_buffer();
+
+    /* Se copia a las columnas; ya no hay un máximo de alumnos. */
+    table_append(table, id, name, gpa);
+    printf("Student added successfully.\n");
+}
+
+/*
+ * Imprime la fila de un alumno.
+ * %-4d  : entero alineado a la izquierda en 4 espacios
+ * %-50s : cadena alineada a la izquierda en 50 espacios
+ * %5.2f : double alineado a la derecha en 5 espacios con 2 decimales
+ */
+void print_student(const StudentTable *table, size_t row)
+{
+    printf("%-4d | %-50s | %5.2f\n",
+           (int)table->ids[row], table_name(table, row), table->gpas[row]);
+}
+
+/*
+ * Imprime todos los registros en una tabla formateada.
+ * param table: la tabla de alumnos
+ *              `const` indica que no se modifican los datos.
+ */
+void print_all_records(const StudentTable *table) 
+{
+    if (table->count == 0) {
+        printf("No records to display.\n");
+        return;
+    }
+
+    printf("\n--- All Student Records ---\n");
+    printf("ID   | Name                                               | GPA\n");
+    printf("-----|----------------------------------------------------|-----\n");
+    for (size_t i = 0; i < table->count; i++)
+        print_student(table, i);
+    printf("----------------------------------------------------------------\n");
+    printf("%zu record(s), average GPA %.2f\n",
+           table->count, average_gpa(table));
+}
+
+/* Busca a un alumno por su id y lo muestra. */
+void find_student(StudentTable *table)
+{
+    int id;
+    if (!read_id(&id))
+        return;
+    size_t row = table_find(table, id);
+    if (row == NO_ROW) {
+        printf("No student with ID %d.\n", id);
+        return;
+    }
+    print_student(table, row);
+}
+
+/*
+ * Cambia el nombre y/o la nota de un alumno. Dejar la respuesta vacía
+ * conserva el valor actual.
+ */
+void update_student(StudentTable *table)
+{
+    int id;
+    char name[MAX_NAME_LEN] = "";
+    char gpa_text[64] = "";
+    double gpa = 0.0;
+
+    if (!read_id(&id))
+        return;
+    size_t row = table_find(table, id);
+    if (row == NO_ROW) {
+        printf("No student with ID %d.\n", id);
+        return;
+    }
+    print_student(table, row);
+
+    printf("Enter new name (empty keeps current): ");
+    if (fgets(name, MAX_NAME_LEN, stdin) != NULL)
+        name[strcspn(name, "\n")] = 0;
+    printf("Enter new GPA (empty keeps current): ");
+    if (fgets(gpa_text, sizeof(gpa_text), stdin) != NULL)
+        gpa_text[strcspn(gpa_text, "\n")] = 0;
+
+    /* Comprobar la nota antes de cambiar nada. */
+    if (gpa_text[0] != '\0' && !parse_gpa(gpa_text, &gpa)) {
+        printf("Invalid GPA. Nothing changed.\n");
+        return;
+    }
+    if (name[0] != '\0')
+        table_set_name(table, row, name);
+    if (gpa_text[0] != '\0')
+        table_set_gpa(table, row, gpa);
+    printf("Student updated successfully.\n");
+}
+
+/* Borra a un alumno por su id. */
+void delete_student(StudentTable *table)
+{
+    int id;
+    if (!read_id(&id))
+        return;
+    if (table_delete(table, id))
+        printf("Student deleted successfully.\n");
+    else
+        printf("No student with ID %d.\n", id);
+}
+
+/*
+ * Escribe una sección del fichero empezando en `offset`. Si la anterior
+ * acabó antes, rellena el hueco con ceros: así cada columna queda
+ * alineada y se puede usar directamente al proyectar el fichero.
+ * Devuelve 1 si todo fue bien y 0 si falló la escritura.
+ */
+int write_section(FILE *file, uint64_t *pos, uint64_t offset,
+                  const void *data, size_t size)
+{
+    while (*pos < offset) {
+        if (fputc(0, file) == EOF)
+            return 0;
+        (*pos)++;
+    }
+    if (size > 0 && fwrite(data, 1, size, file) != size)
+        return 0;
+    *pos += size;
+    return 1;
+}
+
+/*
+ * Guarda toda la tabla de alumnos en `students.db` con el formato
+ * binario: cabecera y columnas tal como están en memoria, sin convertir
+ * nada. Devuelve 1 si se guardó y 0 si no.
+ */
+int save_to_file(const StudentTable *table)
+{
+    uint64_t count = table->count;
+    DbHeader header = {0};
+    memcpy(header.magic, DB_MAGIC, sizeof(header.magic));
+    header.version = DB_VERSION;
+    header.header_size = sizeof(DbHeader);
+    header.count = count;
+    header.ids_offset = sizeof(DbHeader);
+    /* Las columnas de 8 bytes empiezan en un múltiplo de 8. */
+    header.gpas_offset = (header.ids_offset + count * sizeof(int32_t) + 7) &
+                         ~(uint64_t)7;
+    header.name_offsets_offset = header.gpas_offset + count * sizeof(double);
+    header.names_offset = header.name_offsets_offset +
+                          count * sizeof(uint64_t);
+    header.names_len = table->names_len;
+
+    /*
+     * Escribimos en un fichero temporal ("wb": binario) y solo al final
+     * lo renombramos: si algo falla, `students.db` sigue como estaba.
+     */
+    FILE *file = fopen(TEMP_FILENAME, "wb");
+    if (file == NULL) {
+        fprintf(stderr,
+                "Error: Could not open file '%s' for writing.\n",
+                TEMP_FILENAME);
+        return 0;
+    }
+
+    uint64_t pos = 0;
+    int ok = write_section(file, &pos, 0, &header, sizeof(header)) &&
+             write_section(file, &pos, header.ids_offset, table->ids,
+                           count * sizeof(int32_t)) &&
+             write_section(file, &pos, header.gpas_offset, table->gpas,
+                           count * sizeof(double)) &&
+             write_section(file, &pos, header.name_offsets_offset,
+                           table->name_offsets, count * sizeof(uint64_t)) &&
+             write_section(file, &pos, header.names_offset, table->names,
+                           table->names_len);
+    /* `fsync`: que los datos estén en el disco antes de renombrar. */
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0)
+        ok = 0;
+    if (!ok || rename(TEMP_FILENAME, FILENAME) != 0) {
+        fprintf(stderr, "Error: Could not write '%s'.\n", FILENAME);
+        remove(TEMP_FILENAME);
+        return 0;
+    }
+
+    printf("Successfully saved %zu record(s) to %s.\n",
+           table->count, FILENAME);
+    return 1;
+}
+
+/*
+ * Comprueba que una sección de `count` elementos de `width` bytes, que
+ * empieza en `offset`, está alineada y cabe en un fichero de `size`
+ * bytes. Se divide en vez de multiplicar para que un `count` enorme en
+ * un fichero dañado no desborde la cuenta.
+ */
+int section_fits(uint64_t offset, uint64_t count, uint64_t width,
+                 uint64_t size)
+{
+    return offset % width == 0 && offset <= size &&
+           count <= (size - offset) / width;
+}
+
+/*
+ * Carga `students.db` proyectándolo en memoria: se comprueba la
+ * cabecera y las columnas de la tabla pasan a apuntar al fichero. No se
+ * recorre ningún registro, así que tarda lo mismo con cualquier número
+ * de alumnos. Si el fichero es del formato CSV antiguo, se importa.
+ */
+void load_from_file(StudentTable *table)
+{
+    int fd = open(FILENAME, O_RDONLY);
+    if (fd == -1) {
+        /*
+         * Si es la primera ejecución, no es un error que no exista.
+         */
+        printf("No existing database file found. Starting fresh.\n");
+        return;
+    }
+
+    struct stat st;
+    DbHeader header;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat failed");
+        exit(1);
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    ssize_t got = read(fd, &header, sizeof(header));
+    if (got < (ssize_t)sizeof(header.magic) ||
+        memcmp(header.magic, DB_MAGIC, sizeof(header.magic)) != 0) {
+        /* Sin la firma, es un `students.db` de cuando se guardaba en CSV. */
+        close(fd);
+        printf("'%s' is not a binary database; importing it as CSV.\n",
+               FILENAME);
+        import_csv(table, FILENAME);
+        return;
+    }
+
+    /*
+     * Un fichero que no entendemos no se toca: si siguiéramos con la
+     * tabla vacía, el siguiente guardado borraría sus datos.
+     */
+    if (got == (ssize_t)sizeof(header) && header.version != DB_VERSION) {
+        fprintf(stderr, "Error: '%s' has format version %u; "
+                "this program reads version %d.\n",
+                FILENAME, (unsigned)header.version, DB_VERSION);
+        exit(1);
+    }
+    if (got != (ssize_t)sizeof(header) ||
+        header.header_size != sizeof(DbHeader) ||
+        !section_fits(header.ids_offset, header.count, sizeof(int32_t),
+                      size) ||
+        !section_fits(header.gpas_offset, header.count, sizeof(double),
+                      size) ||
+        !section_fits(header.name_offsets_offset, header.count,
+                      sizeof(uint64_t), size) ||
+        !section_fits(header.names_offset, header.names_len, 1, size) ||
+        (header.count > 0 && header.names_len == 0)) {
+        fprintf(stderr, "Error: '%s' is damaged.\n", FILENAME);
+        exit(1);
+    }
+
+    /*
+     * PROT_READ: solo lectura. MAP_PRIVATE: nada de lo que pase en memoria
+     * llega al fichero. Tras proyectarlo ya no hace falta el descriptor.
+     */
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap failed");
+        exit(1);
+    }
+    if (header.names_len > 0 &&
+        base[header.names_offset + header.names_len - 1] != '\0') {
+        fprintf(stderr, "Error: '%s' is damaged.\n", FILENAME);
+        exit(1);
+    }
+
+    table->map = base;
+    table->map_size = size;
+    table->ids = (int32_t *)(base + header.ids_offset);
+    table->gpas = (double *)(base + header.gpas_offset);
+    table->name_offsets = (uint64_t *)(base + header.name_offsets_offset);
+    table->names = base + header.names_offset;
+    table->count = table->capacity = header.count;
+    table->names_len = table->names_capacity = header.names_len;
+
+    printf("Successfully loaded %zu record(s) from %s.\n",
+           table->count, FILENAME);
+}
+
+/*
+ * Añade a la tabla los alumnos de un CSV con líneas `id,nombre,nota`.
+ * El nombre es todo lo que hay entre la primera y la última coma, así
+ * que puede contener comas. Las líneas mal formadas o con un id que ya
+ * existe se saltan y se cuentan. Devuelve 1 si se pudo leer el fichero y 0 si no.
+ */
+int import_csv(StudentTable *table, const char *path)
+{
+    /* "r" para lectura. */
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open file '%s' for reading.\n",
+                path);
+        return 0;
+    }
+
+    /* `getline` reserva y agranda `line` para líneas de cualquier largo. */
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t imported = 0, skipped = 0, duplicates = 0;
+    while (getline(&line, &line_size, file) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0')
+            continue;
+
+        char *first = strchr(line, ',');
+        char *last = strrchr(line, ',');
+        char *end;
+        if (first == NULL || first == last) {
+            skipped++;
+            continue;
+        }
+        long id = strtol(line, &end, 10);
+        if (end == line || end != first || id < INT32_MIN || id > INT32_MAX) {
+            skipped++;
+            continue;
+        }
+        double gpa = strtod(last + 1, &end);
+        if (end == last + 1 || *end != '\0') {
+            skipped++;
+            continue;
+        }
+
+        if (table_find(table, (int)id) != NO_ROW) {
+            duplicates++;
+            continue;
+        }
+
+        *last = '\0';    /* El nombre termina donde empieza la nota */
+        clip_name(first + 1);
+        table_append(table, (int)id, first + 1, gpa);
+        imported++;
+    }
+
+    free(line);
+    fclose(file);
+    printf("Imported %zu record(s) from %s.\n", imported, path);
+    if (skipped > 0)
+        printf("Skipped %zu malformed line(s).\n", skipped);
+    if (duplicates > 0)
+        printf("Skipped %zu line(s) with an ID already in use.\n",
+               duplicates);
+    return 1;
+}
+
+/*
+ * Vuelca la tabla a un CSV para otros programas (una hoja de cálculo,
+ * por ejemplo). La nota se escribe con 2 decimales, como se muestra.
+ * Devuelve 1 si se escribió y 0 si no.
+ */
+int export_csv(const StudentTable *table, const char *path)
+{
+    /*
+     * "w" para escribir; sobrescribe si existe.
+     */
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr,
+                "Error: Could not open file '%s' for writing.\n", path);
+        return 0;
+    }
+
+    for (size_t i = 0; i < table->count; i++)
+        fprintf(file, "%d,%s,%.2f\n",
+                (int)table->ids[i], table_name(table, i), table->gpas[i]);
+
+    if (ferror(file) | fclose(file)) {    /* `|`: cerrar siempre */
+        fprintf(stderr, "Error: Could not write '%s'.\n", path);
+        return 0;
+    }
+    printf("Exported %zu record(s) to %s.\n", table->count, path);
+    return 1;
+}
+
+/*
+ * Pide un nombre de fichero. Devuelve 0 si se dejó vacío o se acabó la
+ * entrada.
+ */
+int read_filename(const char *prompt, char *path, size_t size)
+{
+    printf("%s", prompt);
+    if (fgets(path, (int)size, stdin) == NULL)
+        return 0;
+    path[strcspn(path, "\n")] = '\0';
+    return path[0] != '\0';
+}
+
+/*
+ * Convierte un texto en id o en nota. Devuelve 0 si no es un número
+ * completo (o el id no cabe en 32 bits).
+ */
+int parse_id(const char *text, int *id)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < INT32_MIN || value > INT32_MAX)
+        return 0;
+    *id = (int)value;
+    return 1;
+}
+
+int parse_gpa(const char *text, double *gpa)
+{
+    char *end;
+    *gpa = strtod(text, &end);
+    return end != text && *end == '\0';
+}
+
+/*
+ * Corta `name` a MAX_NAME_LEN - 1 caracteres, los mismos que deja
+ * teclear `fgets` en el menú: así ningún camino guarda nombres más
+ * largos, venga de un CSV o de la línea de órdenes.
+ */
+void clip_name(char *name)
+{
+    if (strlen(name) >= MAX_NAME_LEN)
+        name[MAX_NAME_LEN - 1] = '\0';
+}
+
+/*
+ * Ejecuta una orden de la línea de órdenes, para usar el programa desde
+ * guiones. Las que cambian datos guardan al terminar. Devuelve el
+ * estado de salida: 0 si fue bien.
+ */
+int run_cli(StudentTable *table, int argc, char *argv[])
+{
+    const char *command = argv[1];
+    int id;
+    double gpa = 0.0;
+
+    if (argc == 3 && strcmp(command, "import") == 0)
+        return import_csv(table, argv[2]) && save_to_file(table) ? 0 : 1;
+    if (argc == 3 && strcmp(command, "export") == 0)
+        return export_csv(table, argv[2]) ? 0 : 1;
+
+    if (argc == 3 && strcmp(command, "find") == 0 && parse_id(argv[2], &id)) {
+        size_t row = table_find(table, id);
+        if (row == NO_ROW) {
+            fprintf(stderr, "No student with ID %d.\n", id);
+            return 1;
+        }
+        print_student(table, row);
+        return 0;
+    }
+    if (argc == 3 && strcmp(command, "delete") == 0 &&
+        parse_id(argv[2], &id)) {
+        if (!table_delete(table, id)) {
+            fprintf(stderr, "No student with ID %d.\n", id);
+            return 1;
+        }
+        return save_to_file(table) ? 0 : 1;
+    }
+    /* `update <id> <nombre> <nota>`; un "-" conserva el valor actual. */
+    if (argc == 5 && strcmp(command, "update") == 0 &&
+        parse_id(argv[2], &id) &&
+        (strcmp(argv[4], "-") == 0 || parse_gpa(argv[4], &gpa))) {
+        size_t row = table_find(table, id);
+        if (row == NO_ROW) {
+            fprintf(stderr, "No student with ID %d.\n", id);
+            return 1;
+        }
+        if (strcmp(argv[3], "-") != 0) {
+            clip_name(argv[3]);
+            table_set_name(table, row, argv[3]);
+        }
+        if (strcmp(argv[4], "-") != 0)
+            table_set_gpa(table, row, gpa);
+        print_student(table, row);
+        return save_to_file(table) ? 0 : 1;
+    }
+
+    fprintf(stderr,
+            "Usage: %s [import <file.csv> | export <file.csv> | find <id> |\n"
+            "       update <id> <name|-> <gpa|-> | delete <id>]\n",
+            argv[0]);
+    return 1;
+}
+
+/*
+ * =============================================================================
+ *                            - FIN DE LA LECCIÓN -
+ * =============================================================================
+ *
+ * ¡Enhorabuena! Has construido una aplicación completa de base de datos.
+ * Este proyecto es un hito: demuestra un dominio sólido de las funciones
+ * clave de C para software práctico.
+ *
+ * Logros del proyecto:
+ * 
+ * - Diseño modular con funciones por característica.
+ * - Tabla por columnas que crece sin límite fijo.
+ * - Índice hash por id para buscar, modificar y borrar en O(1).
+ * - Almacenamiento persistente en un fichero binario proyectado con
+ *   `mmap`, con importación y exportación en CSV.
+ * - Menú interactivo limpio para controlar el programa.
+ * - Gestión robusta de entrada del usuario y operaciones de sistema de ficheros.
+ *
+ * CÓMO COMPILAR Y EJECUTAR:
+ * 
+ * 1) Abre una terminal.
+ * 2) Ve al directorio del fichero.
+ * 3) Compila:
+ *    gcc -Wall -Wextra -std=c11 -o registro 17_registro_estudiantes.c
+ * 4) Ejecuta (Linux/macOS; `mmap` es de POSIX, en Windows usa WSL):
+ *    ./registro
+ *
+ * Prueba a añadir alumnos, guardar, salir y volver a ejecutar.
+ * Verás cómo los registros se cargan automáticamente.
+ *
+ * SIN MENÚ, DESDE LA LÍNEA DE ÓRDENES:
+ *
+ *    ./registro import alumnos.csv   # añade el CSV y guarda students.db
+ *    ./registro export alumnos.csv   # vuelca students.db a CSV
+ *    ./registro find 42              # muestra al alumno 42
+ *    ./registro update 42 - 3.75     # nueva nota ("-": sin cambios)
+ *    ./registro delete 42            # lo borra
+ *
+ * El CSV tiene una línea `id,nombre,nota` por alumno; el nombre puede
+ * llevar comas, porque se toma todo lo que hay entre la primera y la
+ * última. Un `students.db` antiguo en CSV se importa solo al arrancar.
+ */
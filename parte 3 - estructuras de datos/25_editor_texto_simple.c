@@ -29,311 +29,6054 @@
  *
  * ESTRUCTURA DE DATOS CENTRAL:
  * 
- * El corazón del editor es una LISTA DOBLEMENTE ENLAZADA. En estas listas,
- * Cada nodo apunta tanto al siguiente como al anterior,
- * lo que facilita insertar o borrar líneas en medio del texto.
+ * La primera versión de `sled` usaba una LISTA DOBLEMENTE ENLAZADA: cada
+ * nodo apuntaba al siguiente y al anterior. Insertar era barato, pero para
+ * LLEGAR a la línea 2.000.000 había que recorrer dos millones de punteros.
  *
- * En nuestro programa, cada nodo representa una línea del archivo.
+ * Ahora el corazón del editor es un ÁRBOL DE ESTADÍSTICOS DE ORDEN: un
+ * árbol binario equilibrado (un "treap") en el que cada nodo guarda
+ * cuántas líneas hay en su subárbol (`size`). El orden de las líneas es
+ * el recorrido en inorden, así que la línea k se encuentra bajando desde
+ * la raíz y comparando k con el tamaño del hijo izquierdo:
+ *
+ *   - si k <= size(izq), la línea está a la izquierda;
+ *   - si k == size(izq) + 1, es este nodo;
+ *   - si no, buscamos k - size(izq) - 1 a la derecha.
+ *
+ * El treap se mantiene equilibrado con una PRIORIDAD aleatoria por nodo
+ * (el padre siempre tiene más prioridad que sus hijos). Con dos
+ * operaciones, `split` (partir el árbol tras k líneas) y `merge` (unir dos
+ * árboles), localizar, insertar y borrar cualquier línea cuesta O(log n).
+ *
+ * En nuestro programa, cada nodo sigue representando una línea del archivo.
+ *
+ * Además recordamos la última línea tocada y su número (el CURSOR o
+ * "dedo"). La mayoría de ediciones caen cerca de la anterior, así que si
+ * la línea pedida está a pocos pasos del cursor caminamos desde él en
+ * lugar de bajar desde la raíz. Insertar y borrar junto a un nodo ya
+ * localizado se hace con ROTACIONES locales, sin partir el árbol.
+ *
+ * CARGA SIN COPIAS CON `mmap`:
+ *
+ * Leer un log de 2 GB con `fgets` y copiar cada línea con `malloc` +
+ * `strcpy` tarda minutos y duplica la memoria. En su lugar PROYECTAMOS el
+ * archivo en memoria con `mmap`: el sistema operativo nos da un puntero
+ * a su contenido y lo lee del disco bajo demanda. Cada línea guarda solo
+ * un puntero a su inicio dentro de esa proyección y su longitud (`len`);
+ * por eso el texto NO termina en '\0' y se imprime con "%.*s".
+ *
+ * Solo las líneas nuevas o modificadas se copian al montón (y se marcan
+ * con `LINE_OWNED`). Abrir un archivo cuesta lo mismo que buscar sus
+ * saltos de línea.
+ *
+ * El precio es que el texto sigue siendo del archivo. Si otro programa
+ * lo reescribe, las líneas que no hemos tocado cambian con él; si lo
+ * trunca, leer lo que ya no existe provoca SIGBUS. Por eso apuntamos su
+ * tamaño y su fecha de modificación al proyectarlo y los comprobamos
+ * antes de cada orden: si cambiaron, copiamos sus páginas a memoria
+ * propia y avisamos. Lo que desaparezca entre dos comprobaciones lo tapa
+ * un manejador de SIGBUS con ceros. Y como `len` es un `int`, un archivo
+ * con una línea de más de 2 GiB no se abre.
+ *
+ * Y buscar los saltos de línea también se reparte: en archivos grandes
+ * cada hilo cuenta los '\n' de un trozo (16 bytes por instrucción con
+ * SIMD), se reservan todos los nodos de golpe y cada hilo construye el
+ * treap de su trozo en tiempo lineal con una pila, sin `merge` por línea.
+ *
+ * MEMORIA EN BLOQUES: POOL DE NODOS Y ARENA DE TEXTO
+ *
+ * Llamar a `malloc` dos veces por línea (nodo + texto) y a `free` otras
+ * dos al salir supone millones de viajes al asignador y nodos dispersos
+ * por el montón. En su lugar pedimos memoria en BLOQUES grandes:
+ *
+ * - Un POOL (slab) de nodos: cada bloque guarda miles de `Line` seguidos.
+ *   Los nodos borrados se apilan en una lista libre y se reutilizan.
+ * - Una ARENA de texto: el texto se copia avanzando un puntero dentro
+ *   del bloque actual ("bump allocation"); no se libera línea a línea.
+ *
+ * Al cerrar el buffer basta con liberar la lista de bloques: unas pocas
+ * llamadas a `free` en lugar de dos por línea.
+ *
+ * UNA TABLA DE PIEZAS (PIECE TABLE)
+ *
+ * Juntando las dos ideas anteriores, el documento es una secuencia de
+ * PIEZAS (spans): cada línea es un trozo de uno de estos dos buffers:
+ *
+ * - El ORIGINAL: el archivo proyectado, de solo lectura.
+ * - El de AÑADIDOS: la arena, en la que solo se escribe al final.
+ *
+ * Insertar, añadir o borrar líneas solo mueve piezas en el árbol; nunca
+ * se copia texto existente. Cada texto añadido se guarda seguido de un
+ * '\n', igual que en el original, de modo que líneas consecutivas suelen
+ * quedar CONTIGUAS en memoria. Al guardar, `save_file` junta las piezas
+ * contiguas y las envía al disco con `writev`, que escribe una lista de
+ * trozos de memoria (`struct iovec`) en una sola llamada al sistema.
+ *
+ * BÚSQUEDA VECTORIAL Y SUSTITUCIÓN EN PARALELO
+ *
+ * Los comandos `/patrón`, `g/patrón/` y `s/viejo/nuevo/` buscan texto
+ * con instrucciones SIMD (una instrucción compara 16 o 32 bytes a la
+ * vez) y eligen en tiempo de ejecución la mejor variante que soporta la
+ * CPU. En buffers grandes, la sustitución reparte las líneas entre
+ * varios HILOS (`pthread`) que trabajan a la vez.
+ *
+ * DESHACER Y REHACER
+ *
+ * Cada orden deja en un HISTORIAL registros pequeños (operación, línea,
+ * número de líneas y un "asa" al texto o a las líneas afectadas). Como el
+ * texto nunca se modifica en su sitio, deshacer un borrado de 50.000
+ * líneas es volver a enganchar el subárbol retirado: nada se copia.
+ *
+ * DIARIO DE RECUPERACIÓN
+ *
+ * Mientras editas, cada orden que cambia el buffer se anota al final de
+ * un archivo "<archivo>.sled-swp". Anotar una línea es muchísimo más
+ * barato que reescribir un archivo enorme, y si el programa se cuelga,
+ * la próxima vez que abras el archivo `sled` repetirá esas órdenes y
+ * recuperará tu trabajo. Al guardar, el diario se vacía. Lo que una
+ * orden toma de fuera del buffer (las líneas que `r` lee de otro
+ * archivo, el registro que pega `x`) se anota con ella, porque al
+ * repetirla podría haber cambiado. Si aun así una orden falla al
+ * repetirse, la recuperación se detiene ahí: las siguientes caerían en
+ * números de línea equivocados.
+ *
+ * GUARDAR EN SEGUNDO PLANO
+ *
+ * Escribir varios gigabytes lleva segundos. Como el texto nunca se
+ * modifica en su sitio, `s` solo toma una INSTANTÁNEA (la lista de
+ * piezas a escribir) y se la pasa a un hilo que la escribe mientras
+ * sigues editando. La orden `e` muestra su progreso y `q` espera a que
+ * termine.
+ *
+ * ARCHIVOS MÁS GRANDES QUE LA MEMORIA
+ *
+ * Con `-m <MiB>` el editor se pone un TOPE de memoria. Al abrir, en vez
+ * de un nodo por línea crea un nodo por BLOQUE de ~1 MiB del archivo
+ * (cada nodo cuenta cuántas líneas representa en `weight`). Un bloque
+ * solo se "expande" en líneas sueltas cuando lo tocas, y tras cada orden
+ * las líneas frías (lejos de las últimas que usaste) se vuelven a juntar
+ * en bloques. Las páginas ya leídas se devuelven al sistema con
+ * `madvise`, y el texto editado que se enfría se vuelca a un archivo
+ * temporal proyectado en memoria, de modo que el sistema también puede
+ * descartarlo.
+ *
+ * ORDENAR Y QUITAR REPETIDOS
+ *
+ * `sort` ordena un vector de CLAVES: cada una guarda los primeros 8
+ * bytes de la línea como un entero, así que casi todas las comparaciones
+ * son una resta y no un salto a memoria lejana. Varios hilos ordenan un
+ * trozo cada uno (ordenación por mezcla) y después se mezclan por
+ * parejas. Si las claves no caben en el tope de `-m`, se ordenan por
+ * trozos que se vuelcan a disco y se mezclan todos a la vez al final
+ * (ordenación EXTERNA). `uniq` recuerda las líneas vistas en una TABLA
+ * HASH y deja solo la primera aparición de cada una.
+ *
+ * ¿QUÉ HE CAMBIADO? (`diff`)
+ *
+ * `diff` compara el buffer con el archivo guardado y muestra los cambios
+ * como `diff -u`. No compara textos sino HASHES de 64 bits: cada línea
+ * se resume en un número, y comparar números es mucho más barato que
+ * comparar textos. Las líneas largas del buffer guardan el suyo en una
+ * tabla aparte, así que la segunda vez solo se recalculan las cortas
+ * (casi gratis) y las editadas. Sobre esas dos secuencias se aplica el
+ * algoritmo de MYERS, que encuentra la lista mínima de líneas borradas y
+ * añadidas en tiempo proporcional al tamaño por el número de cambios.
+ *
+ * SEGUIR UN ARCHIVO QUE CRECE (`-w`)
+ *
+ * Con `-w` el editor pide al núcleo, mediante INOTIFY, que le avise
+ * cuando otro programa modifique el archivo. Mientras espera una orden,
+ * `poll` atiende a la vez el teclado y esos avisos. Si el archivo solo
+ * ha crecido, se leen únicamente los bytes nuevos y sus líneas se
+ * enganchan al final del árbol: seguir un log de varios gigas cuesta lo
+ * que ocupan las líneas nuevas, no volver a abrirlo. Si el archivo se
+ * trunca y no habías tocado nada, se vuelve a cargar; si tenías cambios,
+ * el editor te avisa de que el buffer ya no coincide con el disco.
+ *
+ * MEDIR ANTES DE OPTIMIZAR (`stats` y `--trace`)
+ *
+ * El editor cronometra cada orden y guarda los tiempos en un HISTOGRAMA
+ * logarítmico: cada potencia de 2 se reparte en 8 cubos, así que con
+ * unos cientos de contadores se distingue 1 µs de 1,1 µs y 1 s de
+ * 1,1 s. De él salen la mediana y los percentiles 90 y 99, que dicen
+ * mucho más que la media: una orden que casi siempre tarda 5 µs pero a
+ * veces 50 ms se nota. `stats` muestra esa tabla junto con la memoria
+ * (nodos, arena, historial, proyecciones) y la velocidad de carga y
+ * guardado. Con `--trace <archivo>` el tiempo de cada orden se reparte
+ * además entre bajar por el árbol, reservar memoria y escribir la
+ * salida, y al salir se guarda todo en JSON para compararlo entre
+ * versiones.
+ *
+ * LISTADOS RÁPIDOS Y PAGINADOS
+ *
+ * Un `printf` por línea interpreta el formato cada vez y, en un
+ * terminal, hace una llamada al sistema por línea. `p` y `g//` escriben
+ * el número a mano (dígito a dígito) y el texto con `memcpy` en un
+ * buffer de 64 KiB que se vuelca de una vez. En un terminal el listado
+ * se detiene en cada pantalla como `more`, y Ctrl+C lo corta: recorrer
+ * el árbol cuesta lo que se llega a mostrar, no el tamaño del buffer.
+ *
+ * VARIOS ARCHIVOS A LA VEZ (`o`, `b`, `y`, `x`)
+ *
+ * `o` abre otro archivo y `b` pasa de uno a otro. Todo el editor trabaja
+ * sobre unas variables globales (`root`, `line_count`...) que describen
+ * el archivo ACTIVO; cada archivo abierto guarda una copia de ellas en un
+ * `struct Buffer` y cambiar de archivo es intercambiarlas, como un
+ * sistema operativo cambia de proceso. `y` copia líneas a un registro
+ * común y `x` las pega en el archivo activo. El texto copiado se INTERNA:
+ * una tabla hash recuerda cada línea distinta, de modo que cien archivos
+ * de configuración casi iguales comparten una sola copia de cada línea
+ * repetida.
  *
  * HABILIDADES INTEGRADAS:
  * 
  * - Estructuras (`struct`) para definir nodos.
- * - Punteros (`next`, `prev`) para conectar líneas.
- * - Memoria dinámica (`malloc`/`free`) para gestionar nodos.
- * - E/S de archivos (`fopen`, `fgets`, `fprintf`) para cargar y guardar.
+ * - Punteros (`left`, `right`, `parent`) para conectar líneas.
+ * - Recursión (`split`, `merge`) sobre árboles binarios.
+ * - Memoria dinámica (`malloc`/`free`) en bloques para nodos y texto.
+ * - E/S de archivos (`mmap`, `fopen`, `fprintf`) para cargar y guardar.
  * - Argumentos de línea de comandos (`argc`, `argv`).
+ * - Punteros a función para elegir la búsqueda según la CPU.
+ * - Hilos (`pthread_create`/`pthread_join`) para repartir trabajo.
  * - Funciones modulares y legibles.
  */
 
+#define _POSIX_C_SOURCE 200809L /* Para mmap, fstat y getline con -std=c11 */
+#define _DEFAULT_SOURCE         /* Para madvise(MADV_DONTNEED) */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h> /* Para el uso del flag booleano `modified` */
+#include <stdarg.h>  /* va_list para los mensajes */
+#include <fcntl.h>     /* open */
+#include <unistd.h>    /* close */
+#include <sys/mman.h>  /* mmap, munmap */
+#include <sys/stat.h>  /* fstat */
+#include <sys/uio.h>   /* writev, struct iovec */
+#include <time.h>      /* clock_gettime */
+#include <pthread.h>   /* Hilos para la sustitución en paralelo */
+#include <stdatomic.h> /* Progreso del guardado en segundo plano */
+#include <errno.h>
+#include <signal.h>    /* sigaction: SIGBUS si truncan el archivo */
+#include <limits.h>    /* INT_MAX */
+#include <stdint.h>    /* uintptr_t */
+#include <poll.h>      /* poll: esperar órdenes y avisos a la vez */
+#include <sys/inotify.h> /* Avisos de cambios en el archivo */
+#include <sys/resource.h> /* getrusage: pico de memoria para `stats` */
+#include <sys/ioctl.h> /* TIOCGWINSZ: filas del terminal al paginar */
 
+/* Intrínsecos SIMD: solo en x86-64 con GCC o Clang. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SLED_X86 1
+#endif
 
-/* --- Estructuras de datos y estado global --- 
- * El nodo de la lista doblemente enlazada. 
- * Cada nodo es una línea de texto.
+
+/* --- Estructuras de datos y estado global ---
+ * El nodo del árbol de líneas.
+ * Cada nodo es una línea de texto o, en modo paginado, un BLOQUE de
+ * `weight` líneas seguidas (su texto incluye los '\n' intermedios).
  */
+#define LINE_OWNED 0x1 /* `text` está en la arena, no en la proyección */
+#define LINE_NL    0x2 /* El byte siguiente al texto es un '\n' */
+#define LINE_HOT   0x4 /* Marca temporal de `page_compact` */
+
 typedef struct Line {
-    char *text;        /* Texto de la línea (memoria dinámica) */
-    struct Line *prev; /* Puntero a la línea anterior */
-    struct Line *next; /* Puntero a la línea siguiente */
-} Line;
-
-/* Punteros globales al inicio y final del buffer de texto */
-Line *head = NULL;
-Line *tail = NULL;
+    const char *text;    /* Texto de la línea (sin '\0' final) */
+    int len;             /* Longitud del texto en bytes */
+    unsigned flags : 8;  /* Combinación de LINE_OWNED, LINE_NL, LINE_HOT */
+    unsigned weight : 24; /* Líneas que representa (1 salvo bloques) */
+    struct Line *left;   /* Subárbol con las líneas anteriores */
+    struct Line *right;  /* Subárbol con las líneas siguientes */
+    struct Line *parent; /* Nodo padre (NULL en la raíz) */
+    int size;            /* Número de líneas en este subárbol */
+    unsigned prio;       /* Prioridad aleatoria del treap */
+} Line;                  /* 48 bytes en 64 bits: cada byte cuenta por línea */
+
+/* Raíz del árbol que contiene el buffer de texto */
+Line *root = NULL;
 int line_count = 0;
 bool modified = false; /* Indica si hubo cambios sin guardar */
 
+/*
+ * Cursor: último nodo tocado y el número de su (primera) línea.
+ * Cualquier operación que reordene el árbol (cortes de rangos) debe
+ * invalidarlo.
+ */
+#define CURSOR_WALK 32 /* Pasos máximos que caminamos desde el cursor */
+Line *cursor_line = NULL;
+int cursor_index = 0;
+
+/*
+ * Búsqueda de subcadenas elegida en tiempo de ejecución según la CPU
+ * (ver `init_search`). Devuelve la primera aparición de `needle` en
+ * `hay`, o NULL.
+ */
+typedef const char *(*SearchFn)(const char *hay, size_t n,
+                                const char *needle, size_t m);
+SearchFn search_text = NULL;
+
+#define SUBST_PARALLEL_LINES 200000 /* Desde aquí, sustituir con hilos */
+#define SORT_PARALLEL_LINES 100000  /* Desde aquí, ordenar con hilos */
+#define SORT_RUN 16                 /* Tramos que se ordenan por inserción */
+/*
+ * Las pruebas del reparto entre hilos (fuzz/carga.py) los fuerzan con
+ * archivos diminutos: -DLOAD_PARALLEL_BYTES=1 -DLOAD_THREADS=7.
+ */
+#ifndef LOAD_PARALLEL_BYTES
+#define LOAD_PARALLEL_BYTES (16 << 20) /* Desde aquí, indexar con hilos */
+#endif
+#ifndef LOAD_THREADS
+#define LOAD_THREADS 0                 /* 0: uno por CPU */
+#endif
+#define MAX_THREADS 32
+
+/*
+ * Archivo del que sale una proyección y cómo era al proyectarlo:
+ * `map_check` compara su tamaño y su fecha antes de cada orden.
+ */
+typedef struct {
+    int fd;                    /* Duplicado propio (-1: nada que comprobar) */
+    off_t offset;              /* Dónde empieza la proyección en el archivo */
+    off_t size;
+    struct timespec mtime;
+} MapSource;
+
+/* Proyección en memoria del archivo cargado (NULL si no hay) */
+char *map_base = NULL;
+size_t map_size = 0;
+MapSource map_source = {.fd = -1};
+uintptr_t map_page = 0;        /* Tamaño de página (0: sin manejador SIGBUS) */
+volatile sig_atomic_t map_lost = 0; /* El manejador tapó alguna página */
+
+/*
+ * Trabajo de carga para un hilo: un trozo de la proyección. La primera
+ * pasada rellena `lines` y `last_nl`; la segunda crea `count` nodos a
+ * partir de `line_start` y los organiza en un treap (`tree`).
+ */
+typedef struct {
+    const char *begin, *end;  /* Trozo de la proyección */
+    long lines;               /* Saltos de línea en el trozo */
+    const char *last_nl;      /* Último '\n' del trozo (NULL si no hay) */
+    const char *line_start;   /* Inicio de la primera línea del trozo */
+    long count, first;        /* Nodos del trozo y su posición global */
+    Line *nodes;
+    Line *tree;
+    unsigned seed;            /* Semilla de las prioridades */
+} LoadJob;
+
+/*
+ * Modo paginado (`-m <MiB>`): el archivo se divide en bloques de unos
+ * PAGE_BLOCK_BYTES y cada uno es UN nodo con su número de líneas. Solo
+ * los bloques que se tocan se despliegan en nodos de línea; cuando esos
+ * nodos superan `page_limit` bytes, `page_compact` repliega los menos
+ * usados recientemente. Lo que ya no está en el archivo se escribe en un
+ * archivo temporal de desbordamiento (spill) proyectado en memoria.
+ */
+#define PAGE_BLOCK_BYTES (1 << 20)
+/* `len` es un `int`, y un bloque puede ser una línea entera más. */
+#define MAX_LINE_BYTES (INT_MAX - PAGE_BLOCK_BYTES)
+#define HOT_SLOTS 64           /* Últimos nodos tocados (orden LRU) */
+#define SPILL_MIN_LINES 16     /* Tramos que compensa volcar al spill */
+size_t page_limit = 0;         /* 0: modo paginado desactivado */
+long line_nodes = 0;           /* Nodos creados desde la última compactación */
+Line *hot_ring[HOT_SLOTS];
+int hot_next = 0;              /* Próxima posición a ocupar en `hot_ring` */
+
+typedef struct SpillMap {
+    struct SpillMap *next;
+    char *base;                /* Proyección de un tramo del spill */
+    size_t size;
+    MapSource source;          /* Archivo leído con `r` (fd -1 si no) */
+} SpillMap;
+
+int spill_fd = -1;
+off_t spill_size = 0;
+SpillMap *spill_maps = NULL;
+
+/*
+ * Cabecera de cada bloque de memoria del pool de nodos y de la arena
+ * de texto. Los datos van justo detrás de la cabecera.
+ */
+typedef struct Block {
+    struct Block *next;
+} Block;
+
+#define SAVE_IOVECS 1024 /* Piezas por llamada a writev (IOV_MAX en Linux) */
+#define SAVE_CHUNK (8 << 20) /* Bytes por lote al guardar */
+#define NODES_PER_BLOCK 4096
+#define TEXT_BLOCK_SIZE (256 * 1024)
+
+/* Pool de nodos: bloques, nodos aún sin estrenar y lista libre */
+Block *node_blocks = NULL;
+Line *node_cursor = NULL;
+int nodes_left = 0;
+Line *free_nodes = NULL;
+
+/* Arena de texto (buffer de añadidos): bloques y hueco del actual */
+Block *text_blocks = NULL;
+char *text_cursor = NULL;
+size_t text_left = 0;
+
+/*
+ * Historial de deshacer: un vector creciente de registros compactos.
+ * Cada orden añade uno o más registros (un GRUPO: los registros con
+ * `chained` pertenecen a la misma orden que el anterior). No se guardan
+ * copias del buffer: un borrado guarda el subárbol de líneas retirado,
+ * una sustitución guarda el texto anterior (un puntero a la arena o a la
+ * proyección, que nunca se modifican).
+ */
+enum { UNDO_INSERT, UNDO_DELETE, UNDO_MOVE, UNDO_TEXT };
+
+typedef struct {
+    unsigned char op;    /* UNDO_INSERT, UNDO_DELETE, UNDO_MOVE o UNDO_TEXT */
+    bool chained;        /* Misma orden que el registro anterior */
+    int line;            /* Primera línea afectada */
+    int count;           /* Número de líneas */
+    int dest;            /* UNDO_MOVE: línea tras la que quedaron */
+    Line *tree;          /* Líneas fuera del buffer */
+    const char *text;    /* UNDO_TEXT: texto guardado */
+    int len;
+    unsigned flags;
+} UndoRecord;
+
+UndoRecord *journal = NULL;
+int journal_len = 0;      /* Registros válidos (incluye los de rehacer) */
+int journal_pos = 0;      /* Los registros [pos, len) se pueden rehacer */
+int journal_capacity = 0;
+bool group_open = false;  /* La orden actual ya añadió algún registro */
+
+/*
+ * Diario de recuperación (swap): cada orden que modifica el buffer se
+ * anota, tal cual se escribió, al final de "<archivo>.sled-swp". Si el
+ * programa muere, al volver a abrir el archivo se repiten esas órdenes.
+ * `fdatasync` se agrupa: como mucho cada SWAP_SYNC_EVERY órdenes o
+ * SWAP_SYNC_SECONDS segundos.
+ */
+#define SWAP_SYNC_EVERY 32
+#define SWAP_SYNC_SECONDS 1.0
+int swap_fd = -1;
+char swap_name[4096];
+int swap_unsynced = 0;      /* Órdenes escritas desde el último fdatasync */
+double swap_last_sync = 0;
+
+/*
+ * Guardado en segundo plano: la instantánea de piezas que escribe el
+ * hilo de guardado y su progreso. `written` y `done` los escribe el
+ * hilo y los lee el editor, por eso son atómicos.
+ */
+typedef struct {
+    char filename[4096];
+    char tmp_name[4200];
+    int fd;
+    struct iovec *spans;  /* Instantánea: piezas a escribir, en orden */
+    int span_count;
+    size_t total;         /* Bytes de la instantánea */
+    atomic_size_t written;
+    atomic_bool done;
+    int error;            /* errno si falló, 0 si todo fue bien */
+    double start, elapsed;
+    off_t swap_offset;    /* Tamaño del diario al tomar la instantánea */
+    bool threaded;
+    bool paged;           /* Soltar las páginas ya escritas */
+    pthread_t thread;
+} SaveJob;
+
+SaveJob *save_job = NULL; /* Guardado en curso (NULL si no hay) */
+
+/*
+ * Vigilancia del archivo (`-w`): inotify avisa cuando otro programa lo
+ * modifica. Si solo ha crecido, se añade al buffer únicamente la cola
+ * nueva. `watch_end` son los bytes del archivo que ya están en el buffer
+ * y `watch_tail` la parte final sin '\n' (una línea a medio escribir,
+ * que se vuelve a leer entera cuando se completa). Las colas grandes (y
+ * los archivos grandes leídos con `r`) se proyectan con `mmap`, como el
+ * original; las pequeñas se copian a la arena para no acumular miles de
+ * proyecciones diminutas.
+ */
+#define READ_MAP_BYTES (1 << 20)
+int watch_fd = -1;         /* Descriptor de inotify (-1: sin vigilancia) */
+int watch_wd = -1;         /* Vigilancia activa dentro de `watch_fd` */
+int watch_file = -1;       /* El archivo vigilado, para leer su cola */
+char watch_name[4096];
+off_t watch_end = 0;
+off_t watch_tail = 0;
+bool watch_warned = false; /* Ya avisamos de que el buffer difiere */
+SpillMap *tail_maps = NULL; /* Proyecciones de colas y de `r` */
+
+/*
+ * Modo guion: las órdenes llegan de un archivo o de la entrada estándar,
+ * sin indicador "> " ni mensajes informativos, y el primer error aborta.
+ */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+bool batch_mode = false;
+
+/*
+ * Listados (`p`, `g//`): cada línea se formatea a mano en `list_buffer`
+ * y la salida se escribe en bloques grandes, no con un `printf` por
+ * línea. En un terminal se muestra una pantalla cada vez, y Ctrl+C corta
+ * el listado sin salir del editor.
+ */
+#define LIST_BUFFER_SIZE (64 * 1024)
+#define PAGER_ROWS 24          /* Si el terminal no dice cuántas filas tiene */
+char list_buffer[LIST_BUFFER_SIZE];
+size_t list_len = 0;
+int list_rows = 0;             /* Filas por pantalla (0: sin paginar) */
+int list_shown = 0;            /* Líneas ya mostradas en esta pantalla */
+volatile sig_atomic_t list_interrupted = 0;
+struct sigaction list_old_sigint;
+
+/*
+ * Varios archivos abiertos a la vez (`o`, `b`). El buffer ACTIVO vive en
+ * las variables globales de arriba, así que todo el código sigue usando
+ * `root`, `line_count`, `journal`...; cada archivo abierto guarda en un
+ * `Buffer` una copia de ese estado, y cambiar de archivo es
+ * intercambiarla con las globales (la entrada del activo no está al día
+ * mientras lo es). El pool de nodos, la arena de texto y el registro de
+ * `y`/`x` son comunes a todos: pegar en un archivo líneas de otro solo
+ * crea nodos que apuntan al mismo texto.
+ */
+typedef struct {
+    char *filename;
+    Line *root;
+    int line_count;
+    bool modified;
+    Line *cursor_line;
+    int cursor_index;
+    char *map_base;
+    size_t map_size;
+    MapSource map_source;
+    long line_nodes;
+    Line *hot_ring[HOT_SLOTS];
+    int hot_next;
+    int spill_fd;
+    off_t spill_size;
+    SpillMap *spill_maps;
+    UndoRecord *journal;
+    int journal_len, journal_pos, journal_capacity;
+    int swap_fd;
+    char swap_name[4096];
+    int swap_unsynced;
+    double swap_last_sync;
+    int watch_fd, watch_wd, watch_file;
+    char watch_name[4096];
+    off_t watch_end, watch_tail;
+    bool watch_warned;
+    SpillMap *tail_maps;
+} Buffer;
+
+Buffer *buffers = NULL;
+int buffer_count = 0;
+int buffer_capacity = 0;
+int current_buffer = 0;
+
+Line *yank_tree = NULL;  /* Registro de `y`: líneas sueltas en la arena */
+int yank_lines = 0;
+
+/*
+ * Textos INTERNADOS: cada línea distinta que se teclea o se copia con
+ * `y` se guarda una sola vez en la arena y las repeticiones apuntan a
+ * esa copia. Es una tabla hash con direccionamiento abierto; el texto
+ * nunca se modifica en su sitio, así que compartirlo es seguro. `s///`
+ * no interna: sus líneas nuevas casi nunca se repiten y en millones de
+ * líneas la tabla costaría más de lo que ahorra.
+ */
+typedef struct {
+    const char *text;          /* NULL: hueco libre */
+    int len;
+    uint32_t hash;
+} InternSlot;
+
+InternSlot *intern_slots = NULL;
+size_t intern_capacity = 0;    /* Potencia de 2 */
+size_t intern_count = 0;
+size_t intern_saved = 0;       /* Bytes que no hubo que copiar */
+
+/* Resultado de ejecutar una orden. */
+typedef enum { CMD_OK, CMD_ERROR, CMD_QUIT } CommandResult;
+
+/*
+ * Instrumentación (`stats` y `--trace`). La latencia de cada orden se
+ * mide siempre (dos lecturas del reloj) y se acumula en un histograma
+ * logarítmico al estilo HDR: cada potencia de 2 se parte en 8 cubos, así
+ * que cualquier valor se conoce con un error de ±6% y el histograma
+ * ocupa lo mismo mida nanosegundos u horas. Con `--trace` además se
+ * reparte el tiempo de cada orden entre fases, y al salir se vuelca todo
+ * en JSON.
+ */
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+#define MAX_COMMAND_KINDS 32
+
+enum { PHASE_TREE, PHASE_ALLOC, PHASE_OUTPUT, PHASE_COUNT };
+
+typedef struct {
+    const char *name;               /* Orden: "p", "s///", "sort"... */
+    uint64_t count, total_ns, max_ns;
+    uint64_t phase_ns[PHASE_COUNT]; /* Solo con `--trace` */
+    uint64_t buckets[HIST_BUCKETS];
+} CommandStats;
+
+CommandStats command_stats[MAX_COMMAND_KINDS];
+int command_kinds = 0;
+
+bool trace_on = false;
+const char *trace_path = NULL;     /* Archivo JSON que se escribe al salir */
+uint64_t phase_ns[PHASE_COUNT];    /* Fases de la orden en curso */
+int phase_stack[16];               /* Fases anidadas: cuenta la de arriba */
+int phase_depth = 0;
+uint64_t phase_mark = 0;
+
+size_t pool_bytes = 0;             /* Pedido al sistema para nodos */
+size_t arena_bytes = 0;            /* ...y para la arena de texto */
+size_t load_bytes = 0;
+double load_seconds = 0;
+int save_count = 0;
+size_t save_bytes = 0;
+double save_seconds = 0;
+
 /* --- Prototipos de funciones --- */
 void load_file(const char *filename);
-void save_file(const char *filename);
+bool save_file(const char *filename);
+bool save_finish(void);
+void save_poll(void);
+bool save_wait(void);
+bool save_status(void);
 void free_buffer(void);
-void print_lines(void);
-void insert_line(int line_number, const char *text);
-void delete_line(int line_number);
+bool print_lines(void);
+bool print_range(int first, int last);
+void list_begin(void);
+bool list_line(int number, const char *text, int len);
+void list_end(void);
+bool insert_line(int line_number, const char *text);
+bool delete_line(int line_number);
+bool delete_range(int first, int last);
+bool move_range(int first, int last, int dest);
+bool copy_range(int first, int last, int dest);
+int insert_text(int after, const char *text, size_t len);
+bool read_file(int after, const char *path);
+const char *read_text(int fd, off_t from, size_t *len);
+Line *text_tree(const char *text, size_t len, int *lines);
+int parse_numbers(const char *arg, int nums[], int max);
+void init_search(void);
+char *take_pattern(char **cursor);
+bool find_next(const char *pattern);
+bool list_matches(const char *pattern);
+bool substitute(const char *old_text, const char *new_text);
+bool sort_range(int first, int last);
+bool uniq_range(int first, int last);
+bool diff_buffer(const char *filename);
+uint64_t line_hash(const char *text, int len);
+void hash_cache_clear(void);
 void append_line(const char *text);
 void print_help(void);
+CommandResult run_command(char *input_buffer, const char *filename);
+void message(const char *format, ...);
+bool report_error(const char *format, ...);
+UndoRecord *journal_push(unsigned char op, int line, int count, Line *tree);
+void journal_new_group(void);
+void journal_clear(void);
+bool undo(void);
+bool redo(void);
+bool is_edit_command(const char *input);
+void expand_block(Line *node, int start);
+void touch_line(Line *node);
+void release_text(const char *text, size_t len);
+void page_compact(void);
+Line *build_blocks(const char *text, size_t size, int *lines);
+const char *spill_lines(Line *node, int lines, size_t *size);
+bool write_spans(int fd, struct iovec *iov, int count);
+void swap_recover(const char *filename);
+void swap_open(const char *filename);
+void swap_append(const char *input, size_t length);
+bool swap_replay_read(FILE *swap, const char *record);
+void swap_keep_prefix(FILE *swap, long end);
+void swap_restart(const char *filename, off_t keep_from);
+void swap_close(bool keep);
+void swap_rebase(const char *filename);
+void sigbus_install(void);
+MapSource map_source_open(int fd, off_t offset);
+void map_source_close(MapSource *source);
+void map_check(void);
+bool lines_fit(const char *text, size_t len);
+bool watch_start(const char *filename);
+bool watch_open(const char *filename, off_t end, off_t tail);
+bool watch_poll(void);
+void watch_wait_input(void);
+void watch_stop(void);
+uint64_t now_ns(void);
+uint64_t hash_text(const char *text, size_t len);
+const char *intern_text(const char *text, size_t len);
+void release_buffer(void);
+bool open_buffer(const char *path);
+bool buffer_switch(int index);
+bool list_buffers(void);
+void confirm_quit(void);
+void close_buffers(bool quit);
+bool yank_range(int first, int last);
+void yank_push(const char *text);
+void yank_clear(void);
+bool put_lines(int after);
+const char *command_name(const char *input);
+void stats_record(const char *name, uint64_t ns);
+void trace_enter(int phase);
+void trace_leave(void);
+bool print_stats(void);
+bool write_trace(const char *path);
 
 /* --- Función principal: bucle de control del editor --- */
 int main(int argc, char *argv[])
 {
-    if (argc != 2) {
-        fprintf(stderr, "Uso: %s <nombre_archivo>\n", argv[0]);
+    const char *script = NULL;
+    const char *filename = NULL;
+    bool watch = false;
+    int arg = 1;
+    while (arg < argc) {
+        if (arg + 1 < argc && strcmp(argv[arg], "-m") == 0) {
+            /* Modo paginado con un tope de memoria para los nodos, en MiB. */
+            page_limit = (size_t)(atof(argv[arg + 1]) * 1024 * 1024);
+            if (page_limit == 0)
+                page_limit = 1;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-w") == 0) {
+            watch = true; /* Seguir lo que se añada al archivo */
+            arg++;
+        } else if (arg + 1 < argc && strcmp(argv[arg], "--trace") == 0) {
+            trace_on = true; /* Fases de cada orden y JSON al salir */
+            trace_path = argv[arg + 1];
+            arg += 2;
+        } else {
+            break;
+        }
+    }
+    if (argc == arg + 1 && argv[arg][0] != '-') {
+        filename = argv[arg];
+    } else if (argc == arg + 2 && strcmp(argv[arg], "-") == 0) {
+        batch_mode = true; /* Órdenes desde la entrada estándar */
+        filename = argv[arg + 1];
+    } else if (argc == arg + 3 && strcmp(argv[arg], "-s") == 0) {
+        batch_mode = true; /* Órdenes desde un archivo de guion */
+        script = argv[arg + 1];
+        filename = argv[arg + 2];
+    }
+    if (!filename) {
+        fprintf(stderr,
+                "Uso: %s [-m <MiB>] [-w] [--trace <json>] [-s <guion> | -] "
+                "<nombre_archivo>\n",
+                argv[0]);
         return 1;
     }
 
-    char *filename = argv[1];
-    load_file(filename);
+    FILE *input = stdin;
+    if (script && (input = fopen(script, "r")) == NULL) {
+        perror(script);
+        return 1;
+    }
+    /* En modo guion la salida se acumula en un buffer grande. */
+    if (batch_mode)
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 
-    char input_buffer[1024];
-    printf("Simple Line Editor. Escribe 'h' para ayuda, 'q' para salir.\n");
+    init_search();
+    uint64_t load_start = now_ns();
+    load_file(filename);
+    load_seconds = (now_ns() - load_start) / 1e9;
+    load_bytes = map_size;
+    /* El diario de recuperación solo se usa en sesiones interactivas. */
+    if (!batch_mode) {
+        swap_recover(filename);
+        swap_open(filename);
+    }
+    buffer_capacity = 4;
+    buffers = calloc(buffer_capacity, sizeof(Buffer));
+    buffers[0].filename = strdup(filename);
+    buffer_count = 1;
+    if (watch && watch_start(filename)) {
+        message("Vigilando '%s': lo que se le añada aparecerá al final.\n",
+                filename);
+        /*
+         * Sin buffer en la entrada: si quedaran órdenes leídas por
+         * adelantado en el FILE, `poll` no las vería y esperaría en vano.
+         */
+        if (!batch_mode)
+            setvbuf(stdin, NULL, _IONBF, 0);
+    }
+    message("Simple Line Editor. Escribe 'h' para ayuda, 'q' para salir.\n");
 
+    char *input_line = NULL;
+    char *journal_copy = NULL; /* La orden tal cual, para el diario */
+    size_t capacity = 0;
+    int line_no = 0;
+    int status = 0;
+    bool quit = false;
     while (true) {
-        printf("> ");
-        if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
-            break; /* Salir con Ctrl+D */
-
-        /* procesar comandos y argumentos */
-        char command = input_buffer[0];
-        char *argument = input_buffer + 2;
-        int line_num = atoi(argument);
-
-        switch (command) {
-        case 'p':
-            print_lines();
-            break;
-        case 'a': 
-            /* remover nueva línea de un argumento */
-            argument[strcspn(argument, "\n")] = 0;
-            append_line(argument);
-            break;
-        case 'i': {
-            /* quitar número línea del texto */
-            char *text_start = strchr(argument, ' ');
-            if (text_start) {
-                *text_start = '\0';
-                text_start++;
-                text_start[strcspn(text_start, "\n")] = 0;
-                insert_line(atoi(argument), text_start);
-            } else {
-                printf("Uso: i <número_línea> <texto>\n");
-            }
-            break;
+        save_poll();
+        message("> ");
+        if (!batch_mode)
+            watch_wait_input();
+        ssize_t length = getline(&input_line, &capacity, input);
+        if (length == -1)
+            break; /* Fin de las órdenes (o Ctrl+D) */
+        line_no++;
+        watch_poll(); /* Lo añadido al archivo, antes de ejecutar la orden */
+        map_check();
+
+        /* `run_command` trocea la orden en su sitio: guardamos una copia. */
+        bool journaled = swap_fd != -1 && is_edit_command(input_line);
+        if (journaled) {
+            journal_copy = realloc(journal_copy, length + 1);
+            memcpy(journal_copy, input_line, length + 1);
         }
-        case 'd': //  borrar //
-            delete_line(line_num);
-            break;
-        case 's':
-            save_file(filename);
+
+        const char *name = command_name(input_line);
+        uint64_t start = now_ns();
+        CommandResult result = run_command(input_line,
+                                           buffers[current_buffer].filename);
+        if (name)
+            stats_record(name, now_ns() - start);
+        if (result == CMD_OK && journaled)
+            swap_append(journal_copy, length);
+        if (result == CMD_QUIT) {
+            quit = true;
             break;
-        case 'h':
-            print_help();
+        }
+        if (result == CMD_ERROR && batch_mode) {
+            fprintf(stderr, "sled: error en la orden %d, abortando.\n",
+                    line_no);
+            status = 1;
             break;
-        case 'q':
-            if (modified) {
-                printf("Hay cambios sin guardar. ¿Deseas guardar? (y/n): ");
-                if (fgets(input_buffer, sizeof(input_buffer), stdin) != NULL &&
-                    (input_buffer[0] == 'y' || input_buffer[0] == 'Y'))
-                    save_file(filename);
-            }
-            printf("Saliendo.\n");
-            free_buffer();
-            return 0;
-        default:
-            printf("Comando desconocido. Escribe 'h' para ayuda.\n");
         }
     }
 
-    free_buffer();
-    return 0;
+    save_wait();
+    if (trace_path && !write_trace(trace_path))
+        status = 1;
+    free(input_line);
+    free(journal_copy);
+    if (script)
+        fclose(input);
+    close_buffers(quit);
+    return status;
+}
+
+/*
+ * Interpreta y ejecuta una orden. Devuelve CMD_ERROR si falló (en modo
+ * guion eso detiene la ejecución) o CMD_QUIT si hay que salir.
+ */
+CommandResult run_command(char *input_buffer, const char *filename)
+{
+    /* procesar comandos y argumentos */
+    char command = input_buffer[0];
+    char *argument = input_buffer[1] ? input_buffer + 2 : input_buffer + 1;
+    int nums[3];
+    int count = parse_numbers(argument, nums, 3);
+    bool ok = true;
+
+    /* En los guiones se permiten líneas vacías y comentarios con '#'. */
+    if (batch_mode && (command == '\n' || command == '#'))
+        return CMD_OK;
+
+    journal_new_group();
+    page_compact(); /* Modo paginado: replegar si hay demasiados nodos */
+    switch (command) {
+    case 'p':
+        if (count == 0)
+            ok = print_lines();
+        else if (count == 1)
+            ok = print_range(nums[0], nums[0]);
+        else if (count == 2)
+            ok = print_range(nums[0], nums[1]);
+        else
+            ok = report_error("Uso: p [a[,b]]");
+        break;
+    case 'a':
+        /* remover nueva línea de un argumento */
+        argument[strcspn(argument, "\n")] = 0;
+        append_line(argument);
+        break;
+    case 'i': {
+        /* quitar número línea del texto */
+        char *text_start = strchr(argument, ' ');
+        if (text_start) {
+            *text_start = '\0';
+            text_start++;
+            text_start[strcspn(text_start, "\n")] = 0;
+            ok = insert_line(atoi(argument), text_start);
+        } else {
+            ok = report_error("Uso: i <número_línea> <texto>");
+        }
+        break;
+    }
+    case 'd': //  borrar //
+        if (strncmp(input_buffer, "diff", 4) == 0)
+            ok = diff_buffer(filename);
+        else if (count == 1)
+            ok = delete_line(nums[0]);
+        else if (count == 2)
+            ok = delete_range(nums[0], nums[1]);
+        else
+            ok = report_error("Uso: d <n> | d <a>,<b>");
+        break;
+    case 'm':
+        if (count == 3)
+            ok = move_range(nums[0], nums[1], nums[2]);
+        else
+            ok = report_error("Uso: m <a>,<b>,<c>");
+        break;
+    case 't':
+        if (count == 3)
+            ok = copy_range(nums[0], nums[1], nums[2]);
+        else
+            ok = report_error("Uso: t <a>,<b>,<c>");
+        break;
+    case 's':
+        if (input_buffer[1] == '/') {
+            char *rest = input_buffer + 2;
+            char *old_text = take_pattern(&rest);
+            char *new_text = take_pattern(&rest);
+            ok = substitute(old_text, new_text);
+        } else if (strncmp(input_buffer, "stats", 5) == 0) {
+            ok = print_stats();
+        } else if (strncmp(input_buffer, "sort", 4) == 0) {
+            count = parse_numbers(input_buffer + 4, nums, 3);
+            if (count == 0)
+                ok = line_count == 0 || sort_range(1, line_count);
+            else if (count == 2)
+                ok = sort_range(nums[0], nums[1]);
+            else
+                ok = report_error("Uso: sort [a,b]");
+        } else {
+            ok = save_file(filename);
+        }
+        break;
+    case '/': {
+        char *rest = input_buffer + 1;
+        ok = find_next(take_pattern(&rest));
+        break;
+    }
+    case 'g':
+        if (input_buffer[1] == '/') {
+            char *rest = input_buffer + 2;
+            ok = list_matches(take_pattern(&rest));
+        } else {
+            ok = report_error("Uso: g/<patrón>/");
+        }
+        break;
+    case 'u':
+        if (strncmp(input_buffer, "uniq", 4) == 0) {
+            count = parse_numbers(input_buffer + 4, nums, 3);
+            if (count == 0)
+                ok = line_count == 0 || uniq_range(1, line_count);
+            else if (count == 2)
+                ok = uniq_range(nums[0], nums[1]);
+            else
+                ok = report_error("Uso: uniq [a,b]");
+        } else {
+            ok = undo();
+        }
+        break;
+    case 'U':
+        ok = redo();
+        break;
+    case 'r': {
+        /* `r [n] archivo`: sin número, al final del buffer. */
+        char *path = input_buffer + 1;
+        path[strcspn(path, "\n")] = '\0';
+        path += strspn(path, " ");
+        int after = line_count;
+        char *end;
+        long n = strtol(path, &end, 10);
+        if (end != path && *end == ' ') { /* "r 2024.log" es un nombre */
+            after = n < 0 || n > INT_MAX ? -1 : (int)n;
+            path = end + strspn(end, " ");
+        }
+        ok = *path ? read_file(after, path)
+                   : report_error("Uso: r [n] <archivo>");
+        break;
+    }
+    case 'e':
+        ok = save_status();
+        break;
+    case 'h':
+        print_help();
+        break;
+    case 'o':
+        argument[strcspn(argument, "\n")] = '\0';
+        ok = *argument ? open_buffer(argument)
+                       : report_error("Uso: o <archivo>");
+        break;
+    case 'b':
+        if (count == 0)
+            ok = list_buffers();
+        else if (count == 1)
+            ok = buffer_switch(nums[0] - 1);
+        else
+            ok = report_error("Uso: b [n]");
+        break;
+    case 'y':
+        if (count == 0)
+            ok = line_count == 0 || yank_range(1, line_count);
+        else if (count == 1)
+            ok = yank_range(nums[0], nums[0]);
+        else if (count == 2)
+            ok = yank_range(nums[0], nums[1]);
+        else
+            ok = report_error("Uso: y [a[,b]]");
+        break;
+    case 'x':
+        if (count == 0)
+            ok = put_lines(line_count);
+        else if (count == 1)
+            ok = put_lines(nums[0]);
+        else
+            ok = report_error("Uso: x [n]");
+        break;
+    case 'q':
+        /* En modo guion no se pregunta: hay que guardar con 's'. */
+        if (!batch_mode)
+            confirm_quit();
+        save_wait(); /* No salir con un guardado a medias */
+        message("Saliendo.\n");
+        return CMD_QUIT;
+    default:
+        ok = report_error("Comando desconocido. Escribe 'h' para ayuda.");
+    }
+    return ok ? CMD_OK : CMD_ERROR;
 }
 
 /* --- Implementaciones de funciones --- */
 
+/* Mensaje informativo: se omite en modo guion. */
+void message(const char *format, ...)
+{
+    if (batch_mode)
+        return;
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+/*
+ * Informa de un error (por stderr en modo guion) y devuelve `false`,
+ * así una función puede terminar con `return report_error(...)`.
+ */
+bool report_error(const char *format, ...)
+{
+    FILE *out = batch_mode ? stderr : stdout;
+    va_list args;
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+    fputc('\n', out);
+    return false;
+}
+
 /* Imprime el menú de ayuda. */
 void print_help(void)
 {
     printf("--- Ayuda de sled ---\n");
     printf("p              - Mostrar todas las líneas\n");
+    printf("p <a>,<b>      - Mostrar las líneas <a> a <b>\n");
+    printf("                 (en un terminal, por pantallas; Ctrl+C corta)\n");
     printf("a <texto>      - Añadir una nueva línea al final\n");
     printf("i <n> <texto>  - Insertar antes de la línea <n>\n");
     printf("d <n>          - Borrar la línea <n>\n");
-    printf("s              - Guardar el archivo\n");
+    printf("d <a>,<b>      - Borrar las líneas <a> a <b>\n");
+    printf("m <a>,<b>,<c>  - Mover las líneas <a>-<b> tras la línea <c>\n");
+    printf("t <a>,<b>,<c>  - Copiar las líneas <a>-<b> tras la línea <c>\n");
+    printf("r [n] <archivo> - Insertar <archivo> tras la línea <n> (o al final)\n");
+    printf("y [a[,b]]      - Copiar líneas al registro (todas si no se indican)\n");
+    printf("x [n]          - Pegar el registro tras la línea <n> (o al final)\n");
+    printf("o <archivo>    - Abrir otro archivo (o volver a él si ya está)\n");
+    printf("b [n]          - Listar los archivos abiertos o pasar al <n>\n");
+    printf("/<patrón>      - Buscar la siguiente línea con <patrón>\n");
+    printf("g/<patrón>/    - Listar las líneas que contienen <patrón>\n");
+    printf("s/<viejo>/<nuevo>/ - Sustituir <viejo> por <nuevo> en todo\n");
+    printf("sort [a,b]     - Ordenar las líneas (todas o de <a> a <b>)\n");
+    printf("uniq [a,b]     - Quitar las líneas repetidas (queda la primera)\n");
+    printf("diff           - Mostrar los cambios respecto al archivo en disco\n");
+    printf("stats          - Latencias de las órdenes, memoria y rendimiento\n");
+    printf("u              - Deshacer la última orden\n");
+    printf("U              - Rehacer la última orden deshecha\n");
+    printf("s              - Guardar el archivo (en segundo plano)\n");
+    printf("e              - Estado del guardado en curso\n");
     printf("h              - Mostrar este mensaje de ayuda\n");
     printf("q              - Salir del editor\n");
 }
 
-/* Reserva espacio para una nueva línea. */
-Line *create_line(const char *text)
+/* --- Operaciones del árbol de líneas --- */
+
+/*
+ * Genera la prioridad de un nodo nuevo. Un generador xorshift basta:
+ * solo necesitamos que las prioridades no sigan el orden de inserción.
+ */
+unsigned next_priority(void)
 {
-    Line *new_line = (Line *)malloc(sizeof(Line));
-    if (!new_line) {
-        perror("malloc falló para la línea");
-        exit(1);
-    }
+    static unsigned state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
 
-    new_line->text = malloc(strlen(text) + 1);
-    if (!new_line->text) {
-        perror("malloc falló para el texto");
-        exit(1);
-    }
+/* Número de líneas de un subárbol (0 si está vacío). */
+int tree_size(const Line *node)
+{
+    return node ? node->size : 0;
+}
 
-    strcpy(new_line->text, text);
-    new_line->prev = NULL;
-    new_line->next = NULL;
-    return new_line;
+/*
+ * Recalcula `size` de un nodo a partir de sus hijos y les asigna a
+ * estos su nuevo padre. Se llama cada vez que cambian los hijos.
+ */
+void update_node(Line *node)
+{
+    node->size = node->weight + tree_size(node->left) + tree_size(node->right);
+    if (node->left)
+        node->left->parent = node;
+    if (node->right)
+        node->right->parent = node;
 }
 
-/* Añade una nueva línea al final del buffer. */
-void append_line(const char *text)
+/*
+ * Une dos árboles: todas las líneas de `a` quedan antes que las de `b`.
+ * Sube a la raíz el nodo con mayor prioridad y une recursivamente el resto.
+ */
+Line *merge(Line *a, Line *b)
 {
-    Line *new_line = create_line(text);
-    if (tail == NULL)
-        head = tail = new_line;
-    else {
-        tail->next = new_line;
-        new_line->prev = tail;
-        tail = new_line;
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (a->prio > b->prio) {
+        a->right = merge(a->right, b);
+        update_node(a);
+        a->parent = NULL;
+        return a;
     }
-    line_count++;
-    modified = true;
+    b->left = merge(a, b->left);
+    update_node(b);
+    b->parent = NULL;
+    return b;
 }
 
-/* Carga el contenido del fichero en una nueva lista. */
-void load_file(const char *filename)
+/*
+ * Parte el árbol `node` en dos: `*left` recibe las primeras `k` líneas
+ * y `*right` el resto. El corte no puede caer dentro de un bloque (ver
+ * `make_boundary`).
+ */
+void split(Line *node, int k, Line **left, Line **right)
 {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Nuevo archivo: '%s'\n", filename);
+    if (!node) {
+        *left = *right = NULL;
         return;
     }
 
-    char buffer[1024];
-    while (fgets(buffer, sizeof(buffer), file)) {
-        buffer[strcspn(buffer, "\n")] = 0;
-        append_line(buffer);
+    if (tree_size(node->left) + (int)node->weight <= k) {
+        split(node->right, k - tree_size(node->left) - node->weight,
+              &node->right, right);
+        update_node(node);
+        *left = node;
+    } else {
+        split(node->left, k, left, &node->left);
+        update_node(node);
+        *right = node;
     }
-    fclose(file);
-    modified = false;
+    node->parent = NULL;
+    if (*left)
+        (*left)->parent = NULL;
+    if (*right)
+        (*right)->parent = NULL;
 }
 
-/* Salva el contenido del buffer a un fichero. */
-void save_file(const char *filename)
+/* Primera línea del buffer (el nodo más a la izquierda). */
+Line *first_line(void)
 {
-    FILE *file = fopen(filename, "w");
-    if (file == NULL) {
-        perror("No se pudo abrir el archivo para escritura");
-        return;
-    }
+    Line *node = root;
+    while (node && node->left)
+        node = node->left;
+    return node;
+}
 
-    Line *current = head;
-    while (current != NULL) {
-        fprintf(file, "%s\n", current->text);
-        current = current->next;
+/*
+ * Devuelve la línea siguiente a `node` en el texto (su sucesor en
+ * inorden). Recorrer todo el buffer así cuesta O(n) en total.
+ */
+Line *next_line(Line *node)
+{
+    if (node->right) {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return node;
     }
-    fclose(file);
-    printf("Archivo '%s' guardado.\n", filename);
-    modified = false;
+    while (node->parent && node->parent->right == node)
+        node = node->parent;
+    return node->parent;
 }
 
-/* Libera la memoria usada por el buffer. */
-void free_buffer(void)
+/* Línea anterior a `node` (su predecesor en inorden). */
+Line *prev_line(Line *node)
 {
-    Line *current = head;
-    while (current != NULL) {
-        Line *next = current->next;
-        free(current->text);
-        free(current);
-        current = next;
+    if (node->left) {
+        node = node->left;
+        while (node->right)
+            node = node->right;
+        return node;
     }
-    head = tail = NULL;
-    line_count = 0;
+    while (node->parent && node->parent->left == node)
+        node = node->parent;
+    return node->parent;
 }
 
-/* Imprime todas las líneas con su número. */
-void print_lines(void)
+/*
+ * Rotación: sube `node` un nivel por encima de su padre conservando el
+ * orden de las líneas. Es la pieza básica para insertar y borrar sin
+ * partir el árbol.
+ *
+ *        p              node
+ *       / \             /  \
+ *    node  c    =>     a    p
+ *    /  \                  / \
+ *   a    b                b   c
+ */
+void rotate_up(Line *node)
 {
-    Line *current = head;
-    int i = 1;
-    while (current != NULL) {
-        printf("%4d: %s\n", i++, current->text);
-        current = current->next;
+    Line *p = node->parent;
+    Line *g = p->parent;
+    if (p->left == node) {
+        p->left = node->right;
+        node->right = p;
+    } else {
+        p->right = node->left;
+        node->left = p;
     }
+    update_node(p);
+    update_node(node);
+
+    node->parent = g;
+    if (!g)
+        root = node;
+    else if (g->left == p)
+        g->left = node;
+    else
+        g->right = node;
 }
 
-/* Inserta una línea en una posición específica. */
-void insert_line(int line_number, const char *text)
+/* Suma `delta` al tamaño de `node` y de todos sus antepasados. */
+void adjust_sizes(Line *node, int delta)
 {
-    if (line_number < 1 || line_number > line_count + 1) {
-        printf("Error: número de línea inválido.\n");
-        return;
-    }
+    for (; node; node = node->parent)
+        node->size += delta;
+}
 
-    if (line_number == line_count + 1) {
-        append_line(text);
+/*
+ * Cuelga `node` justo antes de `next` (o al final si `next` es NULL) y lo
+ * sube con rotaciones hasta que su prioridad respete el treap. Como la
+ * prioridad es aleatoria, en promedio hacen falta menos de dos rotaciones.
+ */
+void link_before(Line *node, Line *next)
+{
+    Line *p;
+    if (!root) {
+        root = node;
         return;
     }
+    if (!next) {
+        for (p = root; p->right; p = p->right)
+            ;
+        p->right = node;
+    } else if (!next->left) {
+        p = next;
+        p->left = node;
+    } else {
+        for (p = next->left; p->right; p = p->right)
+            ;
+        p->right = node;
+    }
+    node->parent = p;
+    adjust_sizes(p, node->size);
 
-    Line *new_line = create_line(text);
-    Line *current = head;
-    for (int i = 1; i < line_number; i++)
-        current = current->next;
+    while (node->parent && node->parent->prio < node->prio)
+        rotate_up(node);
+}
 
-    new_line->next = current;
-    new_line->prev = current->prev;
+/*
+ * Descuelga `node` del árbol: lo bajamos con rotaciones (subiendo el
+ * hijo de más prioridad) hasta que tenga como mucho un hijo, y ese hijo
+ * ocupa su lugar.
+ */
+void unlink_node(Line *node)
+{
+    while (node->left && node->right)
+        rotate_up(node->left->prio > node->right->prio ? node->left
+                                                         : node->right);
 
-    if (current->prev == NULL)
-        head = new_line;
+    Line *child = node->left ? node->left : node->right;
+    Line *p = node->parent;
+    if (child)
+        child->parent = p;
+    if (!p)
+        root = child;
+    else if (p->left == node)
+        p->left = child;
     else
-        current->prev->next = new_line;
+        p->right = child;
+    adjust_sizes(p, -(int)node->weight);
+    node->left = node->right = node->parent = NULL;
+    node->size = node->weight;
+}
 
-    current->prev = new_line;
-    line_count++;
-    modified = true;
+/*
+ * Baja desde la raíz hasta el nodo que contiene la línea `k` con la
+ * búsqueda por estadístico de orden descrita al principio; en `*start`
+ * deja el número de su primera línea. No toca el cursor, así que varios
+ * hilos pueden usarla a la vez mientras nadie modifique el árbol.
+ */
+Line *locate_line(int k, int *start)
+{
+    Line *node = root;
+    int base = 0;
+    while (node) {
+        int left_size = tree_size(node->left);
+        if (k <= left_size) {
+            node = node->left;
+        } else if (k <= left_size + (int)node->weight) {
+            *start = base + left_size + 1;
+            return node;
+        } else {
+            k -= left_size + node->weight;
+            base += left_size + node->weight;
+            node = node->right;
+        }
+    }
+    return NULL;
 }
 
-/* Borra la línea de una posición específica. */
-void delete_line(int line_number)
+/*
+ * Devuelve el nodo que contiene la línea `k` (empezando en 1) sin
+ * desplegar bloques. Si el cursor está cerca, caminamos desde él; si no,
+ * bajamos desde la raíz. El nodo encontrado pasa a ser el nuevo cursor.
+ */
+Line *find_node(int k, int *start)
 {
-    if (line_number < 1 || line_number > line_count) {
-        printf("Error: número de línea inválido.\n");
-        return;
+    trace_enter(PHASE_TREE);
+    if (cursor_line && abs(k - cursor_index) <= CURSOR_WALK) {
+        while (cursor_index + (int)cursor_line->weight <= k) {
+            cursor_index += cursor_line->weight;
+            cursor_line = next_line(cursor_line);
+        }
+        while (cursor_index > k) {
+            cursor_line = prev_line(cursor_line);
+            cursor_index -= cursor_line->weight;
+        }
+    } else {
+        cursor_line = locate_line(k, &cursor_index);
     }
+    *start = cursor_index;
+    trace_leave();
+    return cursor_line;
+}
+
+/*
+ * Devuelve la línea número `k` como nodo propio: si cae dentro de un
+ * bloque, el bloque se despliega antes.
+ */
+Line *find_line(int k)
+{
+    if (k < 1 || k > line_count)
+        return NULL;
 
-    Line *to_delete = head;
-    for (int i = 1; i < line_number; i++)
-        to_delete = to_delete->next;
+    int start;
+    Line *node = find_node(k, &start);
+    if (node->weight > 1) {
+        expand_block(node, start);
+        node = find_node(k, &start);
+    }
+    touch_line(node);
+    return node;
+}
 
-    if (to_delete->prev)
-        to_delete->prev->next = to_delete->next;
-    else
-        head = to_delete->next;
+/*
+ * Garantiza que entre las líneas `k` y `k + 1` haya un límite de nodo,
+ * desplegando el bloque que las contenga a las dos.
+ */
+void make_boundary(int k)
+{
+    if (k < 1 || k >= line_count)
+        return;
+    int start;
+    Line *node = locate_line(k, &start);
+    if (start + (int)node->weight - 1 > k)
+        expand_block(node, start);
+}
+
+/*
+ * Separa del buffer las líneas `first`..`last` y devuelve su subárbol;
+ * `*before` y `*after` reciben lo que queda a cada lado. Son dos
+ * `split`, O(log n) sin importar cuántas líneas tenga el rango.
+ */
+Line *cut_range(int first, int last, Line **before, Line **after)
+{
+    Line *rest, *middle;
+    make_boundary(first - 1);
+    make_boundary(last);
+    split(root, first - 1, before, &rest);
+    split(rest, last - first + 1, &middle, after);
+    root = NULL;
+    cursor_line = NULL;
+    return middle;
+}
 
-    if (to_delete->next)
-        to_delete->next->prev = to_delete->prev;
+/* --- Pool de nodos y arena de texto --- */
+
+/* Pide al sistema un bloque nuevo y lo encadena en `*list`. */
+void *new_block(Block **list, size_t bytes)
+{
+    trace_enter(PHASE_ALLOC);
+    Block *block = malloc(sizeof(Block) + bytes);
+    if (!block) {
+        perror("malloc falló para un bloque");
+        exit(1);
+    }
+    block->next = *list;
+    *list = block;
+    if (list == &node_blocks)
+        pool_bytes += bytes;
     else
-        tail = to_delete->prev;
+        arena_bytes += bytes;
+    trace_leave();
+    return block + 1; /* Los datos empiezan tras la cabecera */
+}
 
-    free(to_delete->text);
-    free(to_delete);
-    line_count--;
-    modified = true;
+/* Libera de golpe todos los bloques de una lista. */
+void free_blocks(Block **list)
+{
+    while (*list) {
+        Block *next = (*list)->next;
+        free(*list);
+        *list = next;
+    }
+    if (list == &node_blocks)
+        pool_bytes = 0;
+    else
+        arena_bytes = 0;
 }
 
 /*
- * ====================================================================
- *                          - FIN DE LA LECCIÓN -               
- * ====================================================================
- *
+ * Obtiene un nodo: primero de la lista libre, si no del bloque actual.
+ * La lista libre guarda SUBÁRBOLES enteros enlazados por `parent`; al
+ * sacar uno, apilamos sus dos hijos para reutilizarlos después.
+ */
+Line *alloc_node(void)
+{
+    line_nodes++;
+    if (free_nodes) {
+        Line *node = free_nodes;
+        free_nodes = node->parent;
+        if (node->left) {
+            node->left->parent = free_nodes;
+            free_nodes = node->left;
+        }
+        if (node->right) {
+            node->right->parent = free_nodes;
+            free_nodes = node->right;
+        }
+        return node;
+    }
+    if (nodes_left == 0) {
+        node_cursor = new_block(&node_blocks, NODES_PER_BLOCK * sizeof(Line));
+        nodes_left = NODES_PER_BLOCK;
+    }
+    nodes_left--;
+    return node_cursor++;
+}
+
+/*
+ * Devuelve al pool un subárbol completo en O(1): se apila tal cual y
+ * `alloc_node` lo desmonta nodo a nodo cuando los necesita. Así borrar
+ * 50.000 líneas cuesta lo mismo que borrar una. El texto se queda en
+ * la arena.
+ */
+void recycle_tree(Line *node)
+{
+    if (!node)
+        return;
+    node->parent = free_nodes;
+    free_nodes = node;
+}
+
+/*
+ * Añade `len` bytes al final del buffer de añadidos, seguidos de '\n'.
+ * Los textos más grandes que un bloque reciben un bloque propio.
+ */
+const char *add_text(const char *text, size_t len)
+{
+    trace_enter(PHASE_ALLOC);
+    char *copy;
+    if (len + 1 > text_left && len + 1 > TEXT_BLOCK_SIZE / 4) {
+        copy = new_block(&text_blocks, len + 1);
+    } else {
+        if (len + 1 > text_left) {
+            text_cursor = new_block(&text_blocks, TEXT_BLOCK_SIZE);
+            text_left = TEXT_BLOCK_SIZE;
+        }
+        copy = text_cursor;
+        text_cursor += len + 1;
+        text_left -= len + 1;
+    }
+    if (len > 0) /* Una línea vaciada puede venir de un `text` nulo */
+        memcpy(copy, text, len);
+    copy[len] = '\n';
+    trace_leave();
+    return copy;
+}
+
+/* Duplica la tabla de textos internados y recoloca sus entradas. */
+void intern_grow(void)
+{
+    size_t capacity = intern_capacity ? intern_capacity * 2 : 1024;
+    InternSlot *slots = calloc(capacity, sizeof(InternSlot));
+    if (!slots) {
+        perror("calloc falló para la tabla de textos");
+        exit(1);
+    }
+    for (size_t i = 0; i < intern_capacity; i++) {
+        if (!intern_slots[i].text)
+            continue;
+        size_t j = intern_slots[i].hash & (capacity - 1);
+        while (slots[j].text)
+            j = (j + 1) & (capacity - 1);
+        slots[j] = intern_slots[i];
+    }
+    free(intern_slots);
+    intern_slots = slots;
+    intern_capacity = capacity;
+}
+
+/*
+ * Como `add_text`, pero si ese mismo texto ya está en la arena devuelve
+ * la copia existente en vez de hacer otra.
+ */
+const char *intern_text(const char *text, size_t len)
+{
+    if ((intern_count + 1) * 4 > intern_capacity * 3)
+        intern_grow(); /* Ocupación máxima: 3/4 */
+
+    uint32_t hash = (uint32_t)hash_text(text, len);
+    size_t mask = intern_capacity - 1;
+    size_t i = hash & mask;
+    for (; intern_slots[i].text; i = (i + 1) & mask) {
+        InternSlot *slot = &intern_slots[i];
+        if (slot->hash == hash && (size_t)slot->len == len &&
+            memcmp(slot->text, text, len) == 0) {
+            intern_saved += len + 1;
+            return slot->text;
+        }
+    }
+    intern_slots[i].text = add_text(text, len);
+    intern_slots[i].len = (int)len;
+    intern_slots[i].hash = hash;
+    intern_count++;
+    return intern_slots[i].text;
+}
+
+/*
+ * Crea un nodo que apunta a `len` bytes de `text` sin copiarlos. Es la
+ * forma de enlazar las líneas de la proyección del archivo.
+ */
+Line *create_line_ref(const char *text, int len)
+{
+    Line *new_line = alloc_node();
+
+    new_line->text = text;
+    new_line->len = len;
+    new_line->flags = 0;
+    new_line->weight = 1;
+    new_line->left = NULL;
+    new_line->right = NULL;
+    new_line->parent = NULL;
+    new_line->size = 1;
+    new_line->prio = next_priority();
+    return new_line;
+}
+
+/* Reserva espacio para una nueva línea y lleva su texto a la arena. */
+Line *create_line(const char *text)
+{
+    int len = (int)strlen(text);
+    Line *new_line = create_line_ref(intern_text(text, len), len);
+    new_line->flags = LINE_OWNED | LINE_NL;
+    return new_line;
+}
+
+/* Añade una nueva línea al final del buffer. */
+void append_line(const char *text)
+{
+    root = merge(root, create_line(text));
+    line_count++;
+    journal_push(UNDO_INSERT, line_count, 1, NULL);
+    modified = true;
+}
+
+/*
+ * Carga por flujo para lo que no se puede proyectar (tuberías,
+ * dispositivos). `getline` crece lo necesario: no parte líneas largas.
+ */
+void load_stream(FILE *file)
+{
+    char *buffer = NULL;
+    size_t capacity = 0;
+    ssize_t n;
+    while ((n = getline(&buffer, &capacity, file)) != -1) {
+        if (n > 0 && buffer[n - 1] == '\n')
+            buffer[--n] = '\0';
+        if (n > MAX_LINE_BYTES) {
+            fprintf(stderr, "Hay una línea de más de %d bytes: el editor no "
+                    "puede con ella.\n", MAX_LINE_BYTES);
+            exit(1);
+        }
+        append_line(buffer);
+    }
+    free(buffer);
+}
+
+/*
+ * Cuenta los '\n' de un trozo de memoria. En x86-64 comparamos 16 bytes
+ * a la vez y contamos los bits de la máscara resultante.
+ */
+long count_newlines(const char *p, size_t n)
+{
+    long count = 0;
+    size_t i = 0;
+#ifdef SLED_X86
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+        count += __builtin_popcount(
+            (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl)));
+    }
+#endif
+    for (; i < n; i++)
+        count += p[i] == '\n';
+    return count;
+}
+
+/*
+ * Primera pasada (un hilo por trozo): cuántas líneas TERMINAN en el
+ * trozo y dónde está su último '\n'.
+ */
+void *count_worker(void *arg)
+{
+    LoadJob *job = arg;
+    job->lines = count_newlines(job->begin, job->end - job->begin);
+    job->last_nl = NULL;
+    for (const char *p = job->end; job->lines > 0 && p > job->begin; p--)
+        if (p[-1] == '\n') {
+            job->last_nl = p - 1;
+            break;
+        }
+    return NULL;
+}
+
+/*
+ * Recalcula `size` en todo un subárbol cuyos enlaces ya son correctos.
+ * La profundidad de un treap es O(log n), así que la recursión es corta.
+ */
+int fix_sizes(Line *node)
+{
+    if (!node)
+        return 0;
+    node->size = node->weight + fix_sizes(node->left) + fix_sizes(node->right);
+    return node->size;
+}
+
+/*
+ * Constructor de treaps en tiempo LINEAL. Como los nodos llegan en orden,
+ * basta una pila con el "borde derecho" del árbol: cada nodo nuevo
+ * desapila a los de menor prioridad, que pasan a ser su hijo izquierdo,
+ * y se cuelga a la derecha del que queda arriba.
+ */
+typedef struct {
+    Line **stack;
+    int depth, capacity;
+} TreapBuilder;
+
+void builder_push(TreapBuilder *b, Line *node)
+{
+    Line *last = NULL;
+    while (b->depth > 0 && b->stack[b->depth - 1]->prio < node->prio)
+        last = b->stack[--b->depth];
+    node->left = last;
+    node->right = NULL;
+    node->parent = NULL;
+    if (last)
+        last->parent = node;
+    if (b->depth > 0) {
+        b->stack[b->depth - 1]->right = node;
+        node->parent = b->stack[b->depth - 1];
+    }
+    if (b->depth == b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 64;
+        b->stack = realloc(b->stack, b->capacity * sizeof(Line *));
+        if (!b->stack) {
+            perror("realloc falló al construir el árbol");
+            exit(1);
+        }
+    }
+    b->stack[b->depth++] = node;
+}
+
+/* Termina la construcción: devuelve la raíz con los tamaños al día. */
+Line *builder_finish(TreapBuilder *b)
+{
+    Line *tree = b->depth > 0 ? b->stack[0] : NULL;
+    fix_sizes(tree);
+    free(b->stack);
+    *b = (TreapBuilder){0};
+    return tree;
+}
+
+/*
+ * Segunda pasada: rellena los nodos del trozo (ya reservados, seguidos
+ * en memoria) y construye con ellos un treap en tiempo lineal.
+ */
+void *build_worker(void *arg)
+{
+    LoadJob *job = arg;
+    unsigned state = job->seed;
+    const char *p = job->line_start;
+    TreapBuilder builder = {0};
+
+    for (long k = 0; k < job->count; k++) {
+        const char *nl = memchr(p, '\n', job->end - p);
+        const char *stop = nl ? nl : job->end; /* Última línea sin '\n' */
+        Line *node = &job->nodes[k];
+        node->text = p;
+        node->len = (int)(stop - p);
+        node->flags = nl ? LINE_NL : 0;
+        node->weight = 1;
+        state ^= state << 13; /* Mismo xorshift que `next_priority` */
+        state ^= state >> 17;
+        state ^= state << 5;
+        node->prio = state;
+        p = stop + 1;
+        builder_push(&builder, node);
+    }
+    job->tree = builder_finish(&builder);
+    return NULL;
+}
+
+/*
+ * Indexa la proyección: encuentra los saltos de línea y crea un nodo por
+ * línea. En archivos grandes el trabajo se reparte entre varios hilos en
+ * dos pasadas: primero cada hilo cuenta las líneas de su trozo; con esos
+ * recuentos sabemos dónde empieza cada trozo y reservamos todos los
+ * nodos de una vez; después cada hilo rellena los suyos y construye su
+ * propio treap. Al final unimos los árboles de los trozos en orden.
+ */
+void index_mapping(void)
+{
+    int threads = 1;
+    if (map_size >= LOAD_PARALLEL_BYTES) {
+        long cpus = LOAD_THREADS ? LOAD_THREADS
+                                 : sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : (int)cpus;
+    }
+
+    LoadJob jobs[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    size_t per_thread = map_size / threads;
+    for (int t = 0; t < threads; t++) {
+        jobs[t] = (LoadJob){0};
+        jobs[t].begin = map_base + t * per_thread;
+        jobs[t].end = t == threads - 1 ? map_base + map_size
+                                       : jobs[t].begin + per_thread;
+        jobs[t].seed = next_priority();
+    }
+
+    for (int t = 1; t < threads; t++)
+        pthread_create(&tids[t], NULL, count_worker, &jobs[t]);
+    count_worker(&jobs[0]);
+    for (int t = 1; t < threads; t++)
+        pthread_join(tids[t], NULL);
+
+    /* Cada trozo empieza tras el último '\n' de los trozos anteriores. */
+    long total = 0;
+    const char *start = map_base;
+    for (int t = 0; t < threads; t++) {
+        jobs[t].line_start = start;
+        jobs[t].count = jobs[t].lines;
+        jobs[t].first = total;
+        if (jobs[t].last_nl)
+            start = jobs[t].last_nl + 1;
+        total += jobs[t].count;
+    }
+    if (start < map_base + map_size) {
+        jobs[threads - 1].count++; /* Última línea sin '\n' final */
+        total++;
+    }
+    if (total > INT_MAX) {
+        fprintf(stderr, "Demasiadas líneas para el editor.\n");
+        exit(1);
+    }
+
+    Line *nodes = new_block(&node_blocks, total * sizeof(Line));
+    for (int t = 0; t < threads; t++)
+        jobs[t].nodes = nodes + jobs[t].first;
+
+    for (int t = 1; t < threads; t++)
+        pthread_create(&tids[t], NULL, build_worker, &jobs[t]);
+    build_worker(&jobs[0]);
+    for (int t = 1; t < threads; t++)
+        pthread_join(tids[t], NULL);
+
+    for (int t = 0; t < threads; t++)
+        root = merge(root, jobs[t].tree);
+    line_count = (int)total;
+}
+
+/* --- Modo paginado --- */
+
+/*
+ * Devuelve al sistema las páginas completas de `text`, que debe estar en
+ * una proyección de archivo: si vuelven a hacer falta, se leen otra vez
+ * del disco. Con memoria anónima (la arena) `madvise` BORRARÍA el texto.
+ */
+void release_pages(const char *text, size_t len)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t)text + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)text + len) & ~(page - 1);
+    if (end > begin)
+        madvise((void *)begin, end - begin, MADV_DONTNEED);
+}
+
+/*
+ * En modo paginado, suelta las páginas de `text` si está en el original,
+ * en una cola añadida por la vigilancia o en el spill.
+ */
+void release_text(const char *text, size_t len)
+{
+    if (!page_limit)
+        return;
+    bool mapped = map_base && text >= map_base && text < map_base + map_size;
+    for (SpillMap *m = spill_maps; m && !mapped; m = m->next)
+        mapped = text >= m->base && text < m->base + m->size;
+    for (SpillMap *m = tail_maps; m && !mapped; m = m->next)
+        mapped = text >= m->base && text < m->base + m->size;
+    if (mapped)
+        release_pages(text, len);
+}
+
+/*
+ * Crea los nodos bloque para `size` bytes de texto: cortes cada
+ * PAGE_BLOCK_BYTES, ajustados al siguiente '\n'. Cada bloque guarda su
+ * número de líneas (el resumen que permite saltar bloques enteros al
+ * buscar la línea k). Devuelve el treap y suma las líneas a `*lines`.
+ */
+Line *build_blocks(const char *text, size_t size, int *lines)
+{
+    TreapBuilder builder = {0};
+    const char *p = text;
+    const char *end = text + size;
+    while (p < end) {
+        const char *stop = end;
+        if ((size_t)(end - p) > PAGE_BLOCK_BYTES) {
+            const char *nl = memchr(p + PAGE_BLOCK_BYTES - 1, '\n',
+                                    end - (p + PAGE_BLOCK_BYTES - 1));
+            stop = nl ? nl + 1 : end;
+        }
+        bool final_nl = stop[-1] == '\n';
+        long count = count_newlines(p, stop - p) + !final_nl;
+        if ((long)*lines + count > INT_MAX) {
+            fprintf(stderr, "Demasiadas líneas para el editor.\n");
+            exit(1);
+        }
+
+        Line *block = create_line_ref(p, (int)(stop - p - final_nl));
+        block->flags = final_nl ? LINE_NL : 0;
+        block->weight = count;
+        builder_push(&builder, block);
+        *lines += count;
+        release_text(p, stop - p);
+        p = stop;
+    }
+    return builder_finish(&builder);
+}
+
+/*
+ * Despliega un bloque (que empieza en la línea `start`) en un nodo por
+ * línea, apuntando al mismo texto: no se copia nada.
+ */
+void expand_block(Line *node, int start)
+{
+    Line *before, *rest, *block, *after;
+    split(root, start - 1, &before, &rest);
+    split(rest, node->weight, &block, &after);
+
+    TreapBuilder builder = {0};
+    const char *p = node->text;
+    const char *end = node->text + node->len;
+    for (int i = 0; i < (int)node->weight; i++) {
+        const char *nl = i + 1 < (int)node->weight ? memchr(p, '\n', end - p)
+                                                   : NULL;
+        const char *stop = nl ? nl : end;
+        Line *line = create_line_ref(p, (int)(stop - p));
+        line->flags = nl ? LINE_NL : node->flags & LINE_NL;
+        builder_push(&builder, line);
+        p = stop + 1;
+    }
+    root = merge(merge(before, builder_finish(&builder)), after);
+    recycle_tree(block);
+    cursor_line = NULL;
+}
+
+/* Anota `node` como el último usado (para elegir qué replegar). */
+void touch_line(Line *node)
+{
+    if (!page_limit)
+        return;
+    hot_ring[hot_next] = node;
+    hot_next = (hot_next + 1) % HOT_SLOTS;
+}
+
+/*
+ * Prepara el archivo de desbordamiento para escribir al final. Se crea
+ * en /tmp y se borra en el acto: desaparece solo al cerrarlo.
+ */
+void spill_open(void)
+{
+    if (spill_fd == -1) {
+        char name[] = "/tmp/sled-spill-XXXXXX";
+        spill_fd = mkstemp(name);
+        if (spill_fd == -1) {
+            perror("No se pudo crear el archivo de desbordamiento");
+            exit(1);
+        }
+        unlink(name);
+    }
+    if (lseek(spill_fd, spill_size, SEEK_SET) == -1) {
+        perror("lseek falló en el spill");
+        exit(1);
+    }
+}
+
+/* Escribe en el spill o termina el programa: sin él no hay buffer. */
+void spill_write(struct iovec *iov, int count)
+{
+    if (!write_spans(spill_fd, iov, count)) {
+        perror("No se pudo escribir en el spill");
+        exit(1);
+    }
+}
+
+/*
+ * Proyecta los `size` bytes recién escritos al final del spill y
+ * devuelve dónde empiezan en memoria.
+ */
+const char *spill_map(size_t size)
+{
+    /* `mmap` exige un desplazamiento múltiplo del tamaño de página. */
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t offset = spill_size & ~(page - 1);
+    size_t span = spill_size - offset + size;
+    char *base = mmap(NULL, span, PROT_READ, MAP_PRIVATE, spill_fd, offset);
+    SpillMap *map = malloc(sizeof(SpillMap));
+    if (base == MAP_FAILED || !map) {
+        perror("No se pudo proyectar el spill");
+        exit(1);
+    }
+    *map = (SpillMap){spill_maps, base, span, {.fd = -1}};
+    spill_maps = map;
+    const char *text = base + (spill_size - offset);
+    spill_size += size;
+    return text;
+}
+
+/*
+ * Vuelca al spill el texto de `lines` líneas a partir del nodo `node`
+ * (una tras otra, con su '\n') y devuelve dónde queda en memoria: un
+ * único tramo contiguo.
+ */
+const char *spill_lines(Line *node, int lines, size_t *size)
+{
+    struct iovec iov[SAVE_IOVECS];
+    int count = 0;
+    *size = 0;
+    spill_open();
+    for (int done = 0; done < lines; done += node->weight,
+             node = next_line(node)) {
+        if (count + 2 > SAVE_IOVECS) {
+            spill_write(iov, count);
+            count = 0;
+        }
+        iov[count].iov_base = (char *)node->text;
+        iov[count++].iov_len = node->len;
+        iov[count].iov_base = "\n";
+        iov[count++].iov_len = 1;
+        *size += node->len + 1;
+    }
+    if (count > 0)
+        spill_write(iov, count);
+    return spill_map(*size);
+}
+
+/*
+ * Repliega en bloques el subárbol `range` de `lines` líneas. Las líneas
+ * que siguen contiguas en memoria (lo más habitual: el archivo original
+ * sin tocar) forman bloques directamente; si el tramo está demasiado
+ * troceado, se vuelca entero al spill y los bloques apuntan allí.
+ */
+Line *collapse_range(Line *range, int lines)
+{
+    Line *first = range;
+    while (first->left)
+        first = first->left;
+
+    int pieces = 1;
+    for (Line *a = first, *b = next_line(a); b; a = b, b = next_line(b))
+        if (!(a->flags & LINE_NL) || a->text + a->len + 1 != b->text)
+            pieces++;
+
+    Line *tree;
+    if (lines >= SPILL_MIN_LINES && pieces > lines / SPILL_MIN_LINES) {
+        size_t size;
+        const char *text = spill_lines(first, lines, &size);
+        int count = 0;
+        tree = build_blocks(text, size, &count);
+    } else {
+        TreapBuilder builder = {0};
+        Line *a = first;
+        while (a) {
+            /* Tramo contiguo que empieza en `a`, hasta PAGE_BLOCK_BYTES. */
+            Line *b = a;
+            int weight = 1;
+            Line *n = next_line(b);
+            while (n && (b->flags & LINE_NL) && b->text + b->len + 1 == n->text &&
+                   n->text + n->len - a->text <= PAGE_BLOCK_BYTES) {
+                b = n;
+                weight++;
+                n = next_line(n);
+            }
+            Line *block = create_line_ref(a->text,
+                                          (int)(b->text + b->len - a->text));
+            block->flags = b->flags & LINE_NL;
+            block->weight = weight;
+            builder_push(&builder, block);
+            release_text(a->text, b->text + b->len - a->text);
+            a = n;
+        }
+        tree = builder_finish(&builder);
+    }
+    recycle_tree(range);
+    return tree;
+}
+
+/*
+ * Si los nodos de línea ocupan más de `page_limit`, repliega los tramos
+ * de líneas sueltas menos usados recientemente hasta quedar por debajo
+ * de la mitad. Primero los que no contienen ninguno de los últimos
+ * HOT_SLOTS nodos tocados; si no basta, también los que solo contienen
+ * los toques más antiguos.
+ */
+void page_compact(void)
+{
+    if (!page_limit || line_nodes * sizeof(Line) <= page_limit)
+        return;
+
+    for (int keep = HOT_SLOTS; keep >= 0; keep /= 2) {
+        /* Marcar los `keep` nodos tocados más recientemente. */
+        for (int i = 1; i <= keep && i <= HOT_SLOTS; i++) {
+            Line *hot = hot_ring[(hot_next - i + HOT_SLOTS) % HOT_SLOTS];
+            if (hot)
+                hot->flags |= LINE_HOT;
+        }
+
+        /* Recoger los tramos fríos de líneas sueltas (sin tocar el árbol). */
+        int *runs = NULL;
+        int run_count = 0, run_capacity = 0;
+        long remaining = 0;
+        int k = 1, run_start = 0;
+        bool run_hot = false;
+        for (Line *node = first_line(); ; k += node->weight,
+                 node = next_line(node)) {
+            bool single = node && node->weight == 1;
+            if (single && !run_start) {
+                run_start = k;
+                run_hot = false;
+            }
+            if (single) {
+                run_hot |= (node->flags & LINE_HOT) != 0;
+                continue;
+            }
+            if (run_start) {
+                if (run_hot) {
+                    remaining += k - run_start;
+                } else if (k - run_start > 1) {
+                    if (run_count + 2 > run_capacity) {
+                        run_capacity = run_capacity ? run_capacity * 2 : 64;
+                        runs = realloc(runs, run_capacity * sizeof(int));
+                        if (!runs) {
+                            perror("realloc falló al compactar");
+                            exit(1);
+                        }
+                    }
+                    runs[run_count++] = run_start;
+                    runs[run_count++] = k - 1;
+                }
+                run_start = 0;
+            }
+            if (!node)
+                break;
+        }
+        for (int i = 0; i < HOT_SLOTS; i++)
+            if (hot_ring[i])
+                hot_ring[i]->flags &= ~LINE_HOT;
+
+        for (int r = 0; r < run_count; r += 2) {
+            Line *before, *after;
+            Line *range = cut_range(runs[r], runs[r + 1], &before, &after);
+            range = collapse_range(range, runs[r + 1] - runs[r] + 1);
+            root = merge(merge(before, range), after);
+        }
+        free(runs);
+        line_nodes = remaining;
+        if (line_nodes * sizeof(Line) <= page_limit / 2 || keep == 0)
+            break;
+    }
+    cursor_line = NULL;
+}
+
+/*
+ * Carga el contenido del fichero en un nuevo árbol. El archivo se
+ * proyecta con `mmap` y cada línea apunta directamente a su texto
+ * dentro de la proyección: no se copia ni un byte.
+ */
+void load_file(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        message("Nuevo archivo: '%s'\n", filename);
+        return;
+    }
+
+    struct stat st;
+    bool regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (regular && st.st_size > 0) {
+        sigbus_install();
+        void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            map_base = base;
+            map_size = st.st_size;
+            map_source = map_source_open(fd, 0);
+        }
+    }
+    if (map_base && !lines_fit(map_base, map_size)) {
+        fprintf(stderr, "'%s' tiene una línea de más de %d bytes: el editor "
+                "no puede abrirlo.\n", filename, MAX_LINE_BYTES);
+        exit(1);
+    }
+
+    if (map_base && page_limit) {
+        root = build_blocks(map_base, map_size, &line_count);
+        line_nodes = 0;
+    } else if (map_base) {
+        index_mapping();
+    } else if (!regular) {
+        FILE *file = fdopen(fd, "r");
+        if (file) {
+            load_stream(file);
+            fclose(file); /* También cierra `fd` */
+            journal_clear();
+            modified = false;
+            return;
+        }
+    }
+    close(fd); /* La proyección sigue válida tras cerrar el descriptor */
+    journal_clear();
+    modified = false;
+}
+
+/*
+ * Escribe un lote de piezas con `writev`. Si el sistema escribe solo una
+ * parte, avanzamos por los `iovec` ya enviados y repetimos con el resto.
+ */
+bool write_spans(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0)
+            return false;
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+/*
+ * Sincroniza el directorio que contiene `filename` para que el cambio de
+ * nombre también llegue al disco.
+ */
+void sync_parent_dir(const char *filename)
+{
+    char dir[4096];
+    const char *slash = strrchr(filename, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s",
+                 slash == filename ? 1 : (int)(slash - filename), filename);
+
+    int fd = open(dir, O_RDONLY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+/* Segundos transcurridos en un reloj monotónico (para medir tiempos). */
+double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Añade una pieza a la instantánea, ampliando el vector si hace falta. */
+void push_span(SaveJob *job, const char *base, size_t len, int *capacity)
+{
+    if (job->span_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : SAVE_IOVECS;
+        job->spans = realloc(job->spans, *capacity * sizeof(struct iovec));
+        if (!job->spans) {
+            perror("realloc falló al guardar");
+            exit(1);
+        }
+    }
+    job->spans[job->span_count].iov_base = (char *)base;
+    job->spans[job->span_count++].iov_len = len;
+}
+
+/*
+ * Toma una INSTANTÁNEA del buffer: la lista de piezas que hay que
+ * escribir. Las piezas contiguas en memoria se juntan: si una línea
+ * termina en '\n' y la siguiente empieza justo detrás, ambas caben en el
+ * mismo `iovec`. Un archivo recién abierto es una sola pieza.
+ *
+ * No hace falta copiar texto: ni la proyección ni la arena se modifican
+ * nunca en su sitio, así que los punteros siguen siendo válidos aunque
+ * el buffer cambie mientras otro hilo escribe.
+ */
+void snapshot_spans(SaveJob *job)
+{
+    int capacity = 0;
+    job->total = 0;
+    for (Line *current = first_line(); current; current = next_line(current)) {
+        struct iovec *last = job->span_count > 0
+                                 ? &job->spans[job->span_count - 1] : NULL;
+        if (last && (char *)last->iov_base + last->iov_len == current->text)
+            last->iov_len += current->len;
+        else
+            push_span(job, current->text, current->len, &capacity);
+
+        if (current->flags & LINE_NL)
+            job->spans[job->span_count - 1].iov_len++; /* '\n' ya en memoria */
+        else
+            push_span(job, "\n", 1, &capacity);
+        job->total += current->len + 1;
+    }
+}
+
+/*
+ * En modo paginado, el hilo de guardado suelta las páginas del original
+ * que ya escribió. Solo mira la proyección del original: la lista del
+ * spill la modifica el hilo principal.
+ */
+void save_release(SaveJob *job, const char *text, size_t len)
+{
+    if (job->paged && text >= map_base && text < map_base + map_size)
+        release_pages(text, len);
+}
+
+/*
+ * Cuerpo del hilo de guardado: envía la instantánea al temporal en lotes
+ * de hasta SAVE_IOVECS piezas y SAVE_CHUNK bytes (así el progreso avanza
+ * aunque el archivo sea una sola pieza enorme), lo lleva al disco y lo
+ * renombra sobre el original. Solo toca la instantánea, nunca el árbol.
+ */
+void *save_worker(void *arg)
+{
+    SaveJob *job = arg;
+    bool ok = true;
+    int i = 0;
+    while (ok && i < job->span_count) {
+        struct iovec *span = &job->spans[i];
+        if (span->iov_len > SAVE_CHUNK) {
+            /* Pieza enorme: la enviamos por trozos. */
+            struct iovec part = {span->iov_base, SAVE_CHUNK};
+            ok = write_spans(job->fd, &part, 1);
+            save_release(job, span->iov_base, SAVE_CHUNK);
+            span->iov_base = (char *)span->iov_base + SAVE_CHUNK;
+            span->iov_len -= SAVE_CHUNK;
+            atomic_fetch_add(&job->written, SAVE_CHUNK);
+            continue;
+        }
+        int count = 0;
+        size_t batch = 0;
+        while (i + count < job->span_count && count < SAVE_IOVECS &&
+               batch + span[count].iov_len <= SAVE_CHUNK)
+            batch += span[count++].iov_len;
+        ok = write_spans(job->fd, span, count);
+        for (int k = 0; k < count; k++)
+            save_release(job, span[k].iov_base, span[k].iov_len);
+        atomic_fetch_add(&job->written, batch);
+        i += count;
+    }
+    ok = ok && fsync(job->fd) == 0;
+    if (close(job->fd) != 0 || !ok || rename(job->tmp_name, job->filename) != 0) {
+        job->error = errno;
+        remove(job->tmp_name);
+    } else {
+        sync_parent_dir(job->filename);
+    }
+    job->elapsed = now_seconds() - job->start;
+    atomic_store(&job->done, true);
+    return NULL;
+}
+
+/*
+ * Salva el contenido del buffer a un fichero de forma ATÓMICA:
+ *
+ * 1. Escribimos en un temporal único junto al original (`mkstemp`).
+ * 2. `fsync` garantiza que los datos están en disco.
+ * 3. `rename` sustituye el original de un solo golpe: quien abra el
+ *    archivo verá la versión vieja o la nueva, nunca una a medias.
+ *
+ * Además, las líneas sin modificar apuntan a la proyección del original;
+ * truncarlo con "w" les quitaría el suelo bajo los pies. Tras `rename`,
+ * la proyección sigue viendo el contenido antiguo.
+ *
+ * En una sesión interactiva la escritura la hace un hilo en SEGUNDO
+ * PLANO a partir de una instantánea, y el editor vuelve enseguida al
+ * indicador. En modo guion se espera a que termine.
+ */
+bool save_file(const char *filename)
+{
+    if (save_job)
+        save_wait(); /* Un guardado cada vez */
+
+    SaveJob *job = calloc(1, sizeof(SaveJob));
+    if (!job) {
+        perror("calloc falló al guardar");
+        exit(1);
+    }
+    snprintf(job->filename, sizeof(job->filename), "%s", filename);
+    snprintf(job->tmp_name, sizeof(job->tmp_name), "%s.sled-XXXXXX", filename);
+
+    job->fd = mkstemp(job->tmp_name);
+    if (job->fd == -1) {
+        perror("No se pudo abrir el archivo para escritura");
+        free(job);
+        return false;
+    }
+
+    /*
+     * Conservar los permisos del original (mkstemp crea con 0600). Si es
+     * nuevo, los de `open` con 0666: lo que deje la umask. Leerla exige
+     * cambiarla; ningún otro hilo crea archivos mientras tanto.
+     */
+    struct stat st;
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(job->fd, stat(filename, &st) == 0 ? st.st_mode & 07777
+                                             : 0666 & ~mask);
+
+    job->start = now_seconds();
+    job->paged = page_limit > 0;
+    snapshot_spans(job);
+    /* Las órdenes que lleguen a partir de aquí no entran en este guardado. */
+    job->swap_offset = swap_fd != -1 ? lseek(swap_fd, 0, SEEK_END) : 0;
+    atomic_init(&job->written, 0);
+    atomic_init(&job->done, false);
+    modified = false;
+    save_job = job;
+
+    if (batch_mode || pthread_create(&job->thread, NULL, save_worker, job) != 0) {
+        save_worker(job);
+        return save_finish();
+    }
+    job->threaded = true;
+    message("Guardando '%s' en segundo plano (%zu bytes)...\n", filename,
+            job->total);
+    return true;
+}
+
+/*
+ * Recoge el guardado en curso (que ya debe haber terminado o estar a
+ * punto) e informa del resultado. Si falló, el buffer vuelve a contar
+ * como modificado.
+ */
+bool save_finish(void)
+{
+    SaveJob *job = save_job;
+    if (job->threaded)
+        pthread_join(job->thread, NULL);
+    save_job = NULL;
+
+    bool ok = job->error == 0;
+    if (ok) {
+        message("Archivo '%s' guardado (%zu bytes, %.1f MB/s).\n",
+                job->filename, job->total,
+                job->elapsed > 0 ? job->total / job->elapsed / 1e6 : 0.0);
+        save_count++;
+        save_bytes += job->total;
+        save_seconds += job->elapsed;
+        /* Lo anotado hasta la instantánea ya está en el archivo. */
+        swap_restart(job->filename, job->swap_offset);
+        /* `rename` puso otro archivo en su lugar: vigilamos el nuevo. */
+        if (watch_fd != -1)
+            watch_open(job->filename, (off_t)job->total, 0);
+    } else {
+        errno = job->error;
+        perror("No se pudo guardar el archivo");
+        modified = true;
+    }
+    free(job->spans);
+    free(job);
+    return ok;
+}
+
+/* Si el guardado en segundo plano ya terminó, informa de ello. */
+void save_poll(void)
+{
+    if (save_job && atomic_load(&save_job->done))
+        save_finish();
+}
+
+/* Espera a que termine el guardado en curso, si lo hay. */
+bool save_wait(void)
+{
+    if (!save_job)
+        return true;
+    if (!atomic_load(&save_job->done))
+        message("Esperando a que termine el guardado...\n");
+    return save_finish();
+}
+
+/* `e`: estado del guardado en segundo plano. */
+bool save_status(void)
+{
+    if (!save_job) {
+        printf("No hay ningún guardado en curso.%s\n",
+               modified ? " Hay cambios sin guardar." : "");
+        return true;
+    }
+    size_t written = atomic_load(&save_job->written);
+    double elapsed = now_seconds() - save_job->start;
+    printf("Guardando '%s': %zu de %zu bytes (%.0f%%), %.1f s.\n",
+           save_job->filename, written, save_job->total,
+           save_job->total ? 100.0 * written / save_job->total : 100.0,
+           elapsed);
+    return true;
+}
+
+/*
+ * Vacía el buffer activo: sus nodos (y los que guarda su historial)
+ * vuelven al pool común sin recorrerlos, y se deshacen sus proyecciones.
+ * El texto que tuviera en la arena se queda: puede estar compartido.
+ */
+void release_buffer(void)
+{
+    recycle_tree(root);
+    for (int i = 0; i < journal_len; i++)
+        recycle_tree(journal[i].tree); /* Líneas fuera del buffer */
+    cursor_line = NULL;
+    root = NULL;
+    line_count = 0;
+    journal_clear();
+    hash_cache_clear(); /* Sus claves apuntan al texto que se libera */
+
+    if (map_base) {
+        munmap(map_base, map_size);
+        map_base = NULL;
+        map_size = 0;
+    }
+    map_source_close(&map_source);
+    while (spill_maps) {
+        SpillMap *next = spill_maps->next;
+        munmap(spill_maps->base, spill_maps->size);
+        free(spill_maps);
+        spill_maps = next;
+    }
+    while (tail_maps) {
+        SpillMap *next = tail_maps->next;
+        munmap(tail_maps->base, tail_maps->size);
+        map_source_close(&tail_maps->source);
+        free(tail_maps);
+        tail_maps = next;
+    }
+    if (spill_fd != -1) {
+        close(spill_fd);
+        spill_fd = -1;
+        spill_size = 0;
+    }
+    line_nodes = 0;
+    memset(hot_ring, 0, sizeof(hot_ring));
+    hot_next = 0;
+}
+
+/*
+ * Libera el buffer activo y, con él, el pool y la arena comunes. No hace
+ * falta recorrer el árbol: todos los nodos y textos viven en bloques que
+ * se liberan de golpe.
+ */
+void free_buffer(void)
+{
+    release_buffer();
+    free_blocks(&node_blocks);
+    free_blocks(&text_blocks);
+    node_cursor = NULL;
+    nodes_left = 0;
+    free_nodes = NULL;
+    text_cursor = NULL;
+    text_left = 0;
+    yank_tree = NULL;
+    yank_lines = 0;
+    free(intern_slots);
+    intern_slots = NULL;
+    intern_capacity = intern_count = 0;
+}
+
+/* Imprime todas las líneas con su número. */
+bool print_lines(void)
+{
+    return line_count == 0 || print_range(1, line_count);
+}
+
+/*
+ * Recorrido línea a línea que atraviesa también los bloques del modo
+ * paginado sin desplegarlos.
+ */
+typedef struct {
+    Line *node;        /* Nodo que contiene la línea actual */
+    int left;          /* Líneas del nodo que quedan tras la actual */
+    int number;        /* Número de la línea actual */
+    const char *text;  /* Texto de la línea actual (sin '\n') */
+    int len;
+} LineIter;
+
+/* Calcula la longitud de la línea actual dentro de su nodo. */
+void iter_measure(LineIter *it)
+{
+    const char *end = it->node->text + it->node->len;
+    const char *nl = it->left > 0 ? memchr(it->text, '\n', end - it->text)
+                                  : end;
+    it->len = (int)(nl - it->text);
+}
+
+/* Coloca el iterador en la línea `k` (que debe existir). */
+void iter_seek(LineIter *it, int k)
+{
+    it->node = find_node(k, &it->number);
+    it->text = it->node->text;
+    it->left = it->node->weight - 1;
+    iter_measure(it);
+    for (; it->number < k; it->number++) {
+        it->text += it->len + 1;
+        it->left--;
+        iter_measure(it);
+    }
+}
+
+/* Avanza a la línea siguiente; devuelve false al final del buffer. */
+bool iter_next(LineIter *it)
+{
+    if (it->left > 0) {
+        it->text += it->len + 1;
+        it->left--;
+    } else {
+        if (it->node->weight > 1)
+            release_text(it->node->text, it->node->len);
+        it->node = next_line(it->node);
+        if (!it->node)
+            return false;
+        it->text = it->node->text;
+        it->left = it->node->weight - 1;
+    }
+    it->number++;
+    iter_measure(it);
+    return true;
+}
+
+/*
+ * Escribe `n` como lo haría "%4d: " pero sin pasar por `printf`, que
+ * interpreta el formato en cada llamada. Devuelve los bytes escritos.
+ */
+int format_line_number(char *out, int n)
+{
+    char digits[12];
+    int count = 0;
+    do {
+        digits[count++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+
+    int len = 0;
+    while (len + count < 4)
+        out[len++] = ' ';
+    while (count > 0)
+        out[len++] = digits[--count];
+    out[len++] = ':';
+    out[len++] = ' ';
+    return len;
+}
+
+/* Vacía `list_buffer` en la salida estándar. */
+void list_flush(void)
+{
+    fwrite(list_buffer, 1, list_len, stdout);
+    list_len = 0;
+}
+
+/* Ctrl+C durante un listado: solo se anota, el bucle lo comprueba. */
+void on_sigint(int sig)
+{
+    (void)sig;
+    list_interrupted = 1;
+}
+
+/*
+ * Empieza un listado. Se pagina solo si hay una persona delante: entrada
+ * y salida en un terminal y fuera del modo guion.
+ */
+void list_begin(void)
+{
+    list_len = 0;
+    list_shown = 0;
+    list_rows = 0;
+    list_interrupted = 0;
+    if (batch_mode)
+        return;
+
+    if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)) {
+        struct winsize ws;
+        bool known = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0
+                     && ws.ws_row > 2;
+        list_rows = known ? ws.ws_row : PAGER_ROWS;
+    }
+    /* SA_RESTART: que Ctrl+C no deje a medias una escritura en curso. */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigint;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, &list_old_sigint);
+}
+
+/*
+ * Fin de pantalla: muestra lo pendiente y espera. Intro sigue; `q` (o el
+ * fin de la entrada, o Ctrl+C) corta el listado.
+ */
+bool list_pause(void)
+{
+    list_flush();
+    printf("-- Más: Intro sigue, q corta --");
+    fflush(stdout);
+
+    /* Aquí sí queremos que Ctrl+C interrumpa la lectura (sin SA_RESTART). */
+    struct sigaction sa, restart;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigint;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &restart);
+    char answer[64];
+    bool more = fgets(answer, sizeof(answer), stdin) && answer[0] != 'q';
+    sigaction(SIGINT, &restart, NULL);
+    if (list_interrupted)
+        clearerr(stdin); /* El EINTR no es un fin de la entrada */
+    return more && !list_interrupted;
+}
+
+/*
+ * Añade una línea numerada al listado. Devuelve false si hay que parar
+ * (Ctrl+C o `q` en el paginador); quien llama deja de recorrer, así que
+ * el coste es el de lo que se llega a mostrar.
+ */
+bool list_line(int number, const char *text, int len)
+{
+    if (list_interrupted)
+        return false;
+    if (list_rows > 0 && list_shown == list_rows - 1) {
+        if (!list_pause())
+            return false;
+        list_shown = 0;
+    }
+
+    /* 16 bytes de sobra para el número, los ": " y el '\n'. */
+    if (list_len + len + 16 > LIST_BUFFER_SIZE) {
+        list_flush();
+        if ((size_t)len + 16 > LIST_BUFFER_SIZE) {
+            /* Línea enorme: el número por el buffer, el texto directo. */
+            list_len = format_line_number(list_buffer, number);
+            list_flush();
+            fwrite(text, 1, len, stdout);
+            putchar('\n');
+            list_shown++;
+            return true;
+        }
+    }
+    char *out = list_buffer + list_len;
+    out += format_line_number(out, number);
+    memcpy(out, text, len);
+    out[len] = '\n';
+    list_len = out + len + 1 - list_buffer;
+    list_shown++;
+    return true;
+}
+
+/* Termina un listado: vacía el buffer y devuelve Ctrl+C a su sitio. */
+void list_end(void)
+{
+    list_flush();
+    if (batch_mode)
+        return;
+    sigaction(SIGINT, &list_old_sigint, NULL);
+    if (list_interrupted)
+        printf("\n(listado interrumpido)\n");
+}
+
+/*
+ * Imprime las líneas `first`..`last`. Localizamos la primera en
+ * O(log n) y avanzamos línea a línea hasta el final o hasta que el
+ * paginador (o Ctrl+C) corte.
+ */
+bool print_range(int first, int last)
+{
+    if (first < 1 || last > line_count || first > last)
+        return report_error("Error: rango inválido.");
+
+    LineIter it;
+    iter_seek(&it, first);
+    list_begin();
+    trace_enter(PHASE_OUTPUT); /* Una sola fase: medir cada línea cuesta */
+    while (list_line(it.number, it.text, it.len) && it.number < last)
+        iter_next(&it);
+    trace_leave();
+    list_end();
+    return true;
+}
+
+/*
+ * Inserta una línea en una posición específica: localizamos la línea que
+ * la seguirá (normalmente cerca del cursor) y colgamos la nueva delante.
+ */
+bool insert_line(int line_number, const char *text)
+{
+    if (line_number < 1 || line_number > line_count + 1)
+        return report_error("Error: número de línea inválido.");
+
+    Line *next = find_line(line_number);
+    Line *new_line = create_line(text);
+    link_before(new_line, next);
+    line_count++;
+    cursor_line = new_line;
+    cursor_index = line_number;
+    journal_push(UNDO_INSERT, line_number, 1, NULL);
+    modified = true;
+    return true;
+}
+
+/*
+ * Borra la línea de una posición específica. El cursor pasa a la línea
+ * que ocupa ahora su lugar (o a la anterior si era la última).
+ */
+bool delete_line(int line_number)
+{
+    if (line_number < 1 || line_number > line_count)
+        return report_error("Error: número de línea inválido.");
+
+    Line *to_delete = find_line(line_number);
+    Line *next = next_line(to_delete);
+    Line *prev = next ? NULL : prev_line(to_delete);
+    unlink_node(to_delete);
+    journal_push(UNDO_DELETE, line_number, 1, to_delete);
+    line_count--;
+
+    cursor_line = next ? next : prev;
+    cursor_index = line_number;
+    if (prev)
+        cursor_index -= prev->weight; /* `prev` puede ser un bloque */
+    modified = true;
+    return true;
+}
+
+/*
+ * Desengancha `count` líneas a partir de `first` y devuelve su subárbol,
+ * intacto, para guardarlo en el historial de deshacer.
+ */
+Line *detach_lines(int first, int count)
+{
+    Line *before, *after;
+    Line *removed = cut_range(first, first + count - 1, &before, &after);
+    root = merge(before, after);
+    line_count -= count;
+    return removed;
+}
+
+/* Engancha un subárbol de líneas detrás de la línea `after_line`. */
+void attach_lines(Line *tree, int after_line)
+{
+    Line *before, *after;
+    make_boundary(after_line);
+    line_count += tree_size(tree); /* Antes de `merge`, que lo cambia */
+    split(root, after_line, &before, &after);
+    root = merge(merge(before, tree), after);
+    cursor_line = NULL;
+}
+
+/*
+ * Borra las líneas `first`..`last`: las aislamos con dos cortes y unimos
+ * lo que queda a cada lado. El subárbol borrado no se libera: pasa
+ * entero al historial para poder deshacer el borrado.
+ */
+bool delete_range(int first, int last)
+{
+    if (first < 1 || last > line_count || first > last)
+        return report_error("Error: rango inválido.");
+
+    int count = last - first + 1;
+    journal_push(UNDO_DELETE, first, count, detach_lines(first, count));
+    modified = true;
+    return true;
+}
+
+/*
+ * Corta `count` líneas desde `from` y las engancha detrás de la línea
+ * `to` del texto que queda. Es la operación común a mover y deshacer.
+ */
+void splice_move(int from, int count, int to)
+{
+    attach_lines(detach_lines(from, count), to);
+}
+
+/*
+ * Mueve las líneas `first`..`last` detrás de la línea `dest` (0 = al
+ * principio). Cortamos el rango, cerramos el hueco y lo volvemos a
+ * enganchar en su destino: cuatro `split`/`merge` en total.
+ */
+bool move_range(int first, int last, int dest)
+{
+    if (first < 1 || last > line_count || first > last ||
+        dest < 0 || dest > line_count || (dest >= first && dest < last)) {
+        return report_error("Error: rango inválido.");
+    }
+
+    int count = last - first + 1;
+    if (dest >= last)
+        dest -= count; /* Posición `dest` en el texto sin el rango */
+    splice_move(first, count, dest);
+    journal_push(UNDO_MOVE, first, count, NULL)->dest = dest;
+    modified = true;
+    return true;
+}
+
+/*
+ * Duplica un subárbol con la misma forma y prioridades. Los nodos nuevos
+ * comparten el texto con los originales: solo se copian las piezas.
+ */
+Line *clone_tree(const Line *node)
+{
+    if (!node)
+        return NULL;
+    Line *copy = alloc_node();
+    *copy = *node;
+    copy->left = clone_tree(node->left);
+    copy->right = clone_tree(node->right);
+    update_node(copy);
+    copy->parent = NULL;
+    return copy;
+}
+
+/* Copia las líneas `first`..`last` detrás de la línea `dest`. */
+bool copy_range(int first, int last, int dest)
+{
+    if (first < 1 || last > line_count || first > last ||
+        dest < 0 || dest > line_count) {
+        return report_error("Error: rango inválido.");
+    }
+
+    Line *before, *after;
+    Line *range = cut_range(first, last, &before, &after);
+    Line *copy = clone_tree(range);
+    root = merge(merge(before, range), after);
+
+    attach_lines(copy, dest);
+    journal_push(UNDO_INSERT, dest + 1, last - first + 1, NULL);
+    modified = true;
+    return true;
+}
+
+/*
+ * `r n archivo`: inserta el contenido de otro archivo tras la línea `n`
+ * (0 para ponerlo al principio). El fragmento se convierte en un árbol
+ * suelto con el mismo cargador rápido que el archivo principal y se
+ * engancha con un solo corte y dos uniones: O(log n) sea cual sea su
+ * tamaño, en vez de una inserción por línea.
+ */
+bool read_file(int after, const char *path)
+{
+    if (after < 0 || after > line_count)
+        return report_error("Error: número de línea inválido.");
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return report_error("Error: no se pudo abrir '%s': %s", path,
+                            strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return report_error("Error: '%s' no es un archivo normal.", path);
+    }
+
+    size_t len = (size_t)st.st_size;
+    const char *text = len > 0 ? read_text(fd, 0, &len) : NULL;
+    close(fd); /* Una proyección sigue siendo válida sin el descriptor */
+    if (!text) {
+        message("0 líneas leídas de '%s'.\n", path);
+        return true;
+    }
+    if (!lines_fit(text, len))
+        return report_error("Error: '%s' tiene una línea de más de %d bytes.",
+                            path, MAX_LINE_BYTES);
+
+    int lines = insert_text(after, text, len);
+    if (lines < 0)
+        return report_error("Error: demasiadas líneas para el editor.");
+    /*
+     * Al diario va el texto leído, no el nombre: si se recupera más tarde,
+     * el archivo puede haber cambiado o ya no existir.
+     */
+    if (swap_fd != -1) {
+        char header[64];
+        int length = snprintf(header, sizeof(header), "R %d %zu\n", after,
+                              len);
+        swap_append(header, length);
+        swap_append(text, len);
+        swap_append("\n", 1);
+    }
+    message("%d líneas leídas de '%s'.\n", lines, path);
+    return true;
+}
+
+/*
+ * Engancha las líneas de `text` tras la línea `after` como una sola
+ * edición (un solo paso de deshacer). Devuelve cuántas líneas eran, o
+ * -1 si no caben en el editor.
+ */
+int insert_text(int after, const char *text, size_t len)
+{
+    int lines = 0;
+    Line *tree = text_tree(text, len, &lines);
+    if ((long)line_count + lines > INT_MAX) {
+        recycle_tree(tree);
+        return -1;
+    }
+    attach_lines(tree, after);
+    journal_push(UNDO_INSERT, after + 1, lines, NULL);
+    modified = true;
+    return lines;
+}
+
+/* --- Historial de deshacer/rehacer --- */
+
+/*
+ * Añade un registro al historial. Si habíamos deshecho algo, esos
+ * registros (la parte de "rehacer") se descartan: las líneas que
+ * guardaban las inserciones deshechas vuelven al pool.
+ */
+UndoRecord *journal_push(unsigned char op, int line, int count, Line *tree)
+{
+    for (int i = journal_pos; i < journal_len; i++)
+        if (journal[i].op == UNDO_INSERT)
+            recycle_tree(journal[i].tree);
+    journal_len = journal_pos;
+
+    if (journal_len == journal_capacity) {
+        journal_capacity = journal_capacity ? journal_capacity * 2 : 64;
+        journal = realloc(journal, journal_capacity * sizeof(UndoRecord));
+        if (!journal) {
+            perror("realloc falló para el historial");
+            exit(1);
+        }
+    }
+
+    UndoRecord *record = &journal[journal_len++];
+    *record = (UndoRecord){0};
+    record->op = op;
+    record->chained = group_open;
+    record->line = line;
+    record->count = count;
+    record->tree = tree;
+    journal_pos = journal_len;
+    group_open = true;
+    return record;
+}
+
+/* Marca el comienzo de una orden: sus registros forman un grupo. */
+void journal_new_group(void)
+{
+    group_open = false;
+}
+
+/* Vacía el historial (al cargar un archivo o liberar el buffer). */
+void journal_clear(void)
+{
+    free(journal);
+    journal = NULL;
+    journal_len = journal_pos = journal_capacity = 0;
+}
+
+/*
+ * Intercambia el texto de una línea (o de un bloque de `count` líneas)
+ * con el guardado en el registro. Si el bloque se desplegó desde
+ * entonces, sus líneas actuales se vuelcan juntas al spill para volver
+ * a tener un único nodo.
+ */
+void swap_text(UndoRecord *record)
+{
+    Line *line;
+    if (record->count == 1) {
+        line = find_line(record->line);
+    } else {
+        Line *before, *after;
+        line = cut_range(record->line, record->line + record->count - 1,
+                         &before, &after);
+        if ((int)line->weight != record->count) {
+            Line *first = line;
+            while (first->left)
+                first = first->left;
+            size_t size;
+            const char *text = spill_lines(first, record->count, &size);
+            recycle_tree(line);
+            line = create_line_ref(text, (int)size - 1);
+            line->flags = LINE_NL;
+            line->weight = record->count;
+            line->size = record->count;
+        }
+        root = merge(merge(before, line), after);
+    }
+    const char *text = line->text;
+    int len = line->len;
+    unsigned flags = line->flags;
+    line->text = record->text;
+    line->len = record->len;
+    line->flags = record->flags;
+    record->text = text;
+    record->len = len;
+    record->flags = flags;
+}
+
+/* Deshace un registro. Las inserciones guardan las líneas que retiran. */
+void undo_record(UndoRecord *record)
+{
+    switch (record->op) {
+    case UNDO_INSERT:
+        record->tree = detach_lines(record->line, record->count);
+        break;
+    case UNDO_DELETE:
+        attach_lines(record->tree, record->line - 1);
+        record->tree = NULL;
+        break;
+    case UNDO_MOVE:
+        splice_move(record->dest + 1, record->count, record->line - 1);
+        break;
+    case UNDO_TEXT:
+        swap_text(record);
+        break;
+    }
+}
+
+/* Vuelve a aplicar un registro deshecho. */
+void redo_record(UndoRecord *record)
+{
+    switch (record->op) {
+    case UNDO_INSERT:
+        attach_lines(record->tree, record->line - 1);
+        record->tree = NULL;
+        break;
+    case UNDO_DELETE:
+        record->tree = detach_lines(record->line, record->count);
+        break;
+    case UNDO_MOVE:
+        splice_move(record->line, record->count, record->dest);
+        break;
+    case UNDO_TEXT:
+        swap_text(record);
+        break;
+    }
+}
+
+/* `u`: deshace la última orden (todos los registros de su grupo). */
+bool undo(void)
+{
+    if (journal_pos == 0)
+        return report_error("Nada que deshacer.");
+
+    UndoRecord *record;
+    do {
+        record = &journal[--journal_pos];
+        undo_record(record);
+    } while (record->chained);
+    cursor_line = NULL;
+    modified = true;
+    return true;
+}
+
+/* `U`: rehace la última orden deshecha. */
+bool redo(void)
+{
+    if (journal_pos == journal_len)
+        return report_error("Nada que rehacer.");
+
+    do
+        redo_record(&journal[journal_pos++]);
+    while (journal_pos < journal_len && journal[journal_pos].chained);
+    cursor_line = NULL;
+    modified = true;
+    return true;
+}
+
+/* --- Diario de recuperación (swap) --- */
+
+/* ¿Modifica el buffer esta orden? Solo esas se anotan en el diario. */
+bool is_edit_command(const char *input)
+{
+    switch (input[0]) {
+    case 'a': case 'i': case 'm': case 't': case 'u': case 'U': case 'x':
+        return true; /* `r` se anota sola, con el texto (`read_file`) */
+    case 'd':
+        return strncmp(input, "diff", 4) != 0;
+    case 's':
+        return input[1] == '/' || strncmp(input, "sort", 4) == 0;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Cabecera del diario: identifica la versión del archivo sobre la que
+ * se aplicaron las órdenes (tamaño y fecha de modificación). Si el
+ * archivo cambia por otro lado, repetir las órdenes no tendría sentido.
+ */
+int swap_header(const char *filename, char *header, size_t size)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return snprintf(header, size, "sled-swap 1 -1 0 0\n");
+    return snprintf(header, size, "sled-swap 1 %lld %lld %ld\n",
+                    (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+                    (long)st.st_mtim.tv_nsec);
+}
+
+/*
+ * Si existe un diario de una sesión que terminó mal, repite sus órdenes
+ * sobre el archivo recién cargado. Las órdenes se ejecutan en silencio,
+ * como en modo guion.
+ */
+void swap_recover(const char *filename)
+{
+    snprintf(swap_name, sizeof(swap_name), "%s.sled-swp", filename);
+    FILE *swap = fopen(swap_name, "r");
+    if (swap == NULL)
+        return;
+
+    char expected[128];
+    swap_header(filename, expected, sizeof(expected));
+    char *line = NULL;
+    size_t capacity = 0;
+    if (getline(&line, &capacity, swap) == -1 || strcmp(line, expected) != 0) {
+        /* El archivo cambió desde entonces: apartamos el diario viejo. */
+        char old_name[4200];
+        snprintf(old_name, sizeof(old_name), "%s.old", swap_name);
+        rename(swap_name, old_name);
+        printf("Aviso: '%s' no corresponde a este archivo; guardado como "
+               "'%s'.\n", swap_name, old_name);
+        free(line);
+        fclose(swap);
+        return;
+    }
+
+    int replayed = 0;
+    bool failed = false;
+    long good_end = ftell(swap); /* Hasta aquí, todo repetido sin errores */
+    bool was_batch = batch_mode;
+    batch_mode = true;
+    while (getline(&line, &capacity, swap) != -1) {
+        /*
+         * Las líneas `Y` no son órdenes que se puedan teclear: solo las
+         * escribe `swap_yank` para rehacer el registro antes de un `x`.
+         */
+        if (line[0] == 'Y') {
+            line[strcspn(line, "\n")] = '\0';
+            if (line[1] == ' ')
+                yank_push(line + 2);
+            else
+                yank_clear();
+            continue;
+        }
+        bool ok = line[0] == 'R' ? swap_replay_read(swap, line)
+                                 : run_command(line, filename) != CMD_ERROR;
+        if (!ok) {
+            failed = true;
+            break;
+        }
+        replayed++;
+        good_end = ftell(swap);
+    }
+    batch_mode = was_batch;
+    free(line);
+
+    /*
+     * Una orden que falla deja el buffer distinto de como estaba cuando se
+     * anotó, y las siguientes caerían en líneas equivocadas: nos quedamos
+     * con lo repetido hasta ahí. El diario entero se aparta para poder
+     * revisarlo y el activo se queda solo con la parte que sí se aplicó.
+     */
+    if (failed) {
+        char old_name[4200];
+        snprintf(old_name, sizeof(old_name), "%s.old", swap_name);
+        rename(swap_name, old_name);
+        swap_keep_prefix(swap, good_end);
+        printf("Aviso: la orden %d del diario no se pudo repetir y la "
+               "recuperación se detiene ahí. El diario completo queda en "
+               "'%s'.\n", replayed + 1, old_name);
+    }
+    fclose(swap);
+
+    if (replayed > 0) {
+        printf("Recuperadas %d órdenes sin guardar de '%s'.\n", replayed,
+               swap_name);
+        modified = true;
+    }
+}
+
+/*
+ * Repite un registro `R <n> <bytes>` del diario: tras la cabecera vienen
+ * los bytes exactos que leyó `r` y un '\n'. Se insertan tras la línea
+ * `n` sin volver a abrir el archivo de origen.
+ */
+bool swap_replay_read(FILE *swap, const char *record)
+{
+    int after;
+    size_t len;
+    if (sscanf(record, "R %d %zu", &after, &len) != 2 || after < 0 ||
+        after > line_count || len == 0)
+        return false;
+    char *text = malloc(len);
+    bool ok = text && fread(text, 1, len, swap) == len && fgetc(swap) == '\n';
+    if (ok) {
+        journal_new_group();
+        ok = insert_text(after, add_text(text, len), len) >= 0;
+    }
+    free(text);
+    return ok;
+}
+
+/*
+ * Crea de nuevo el diario con los primeros `end` bytes de `swap` (la
+ * cabecera y las órdenes que se repitieron bien), para seguir anotando
+ * detrás de ellas.
+ */
+void swap_keep_prefix(FILE *swap, long end)
+{
+    int fd = open(swap_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    char chunk[65536];
+    long done = 0;
+    fseek(swap, 0, SEEK_SET);
+    while (fd != -1 && done < end) {
+        size_t want = end - done < (long)sizeof(chunk) ? (size_t)(end - done)
+                                                       : sizeof(chunk);
+        size_t got = fread(chunk, 1, want, swap);
+        if (got == 0 || write(fd, chunk, got) != (ssize_t)got)
+            break;
+        done += (long)got;
+    }
+    if (fd == -1 || done < end)
+        perror("Aviso: no se pudo rehacer el diario");
+    if (fd != -1)
+        close(fd);
+}
+
+/*
+ * Abre el diario para añadir órdenes. Si no existía (o lo acabamos de
+ * apartar), empieza con la cabecera del archivo actual.
+ */
+void swap_open(const char *filename)
+{
+    snprintf(swap_name, sizeof(swap_name), "%s.sled-swp", filename);
+    swap_fd = open(swap_name, O_RDWR | O_APPEND | O_CREAT, 0600);
+    if (swap_fd == -1) {
+        perror("Aviso: no se pudo crear el diario de recuperación");
+        return;
+    }
+    if (lseek(swap_fd, 0, SEEK_END) == 0)
+        swap_restart(filename, 0);
+    swap_last_sync = now_seconds();
+}
+
+/*
+ * Anota una orden ya aplicada. `write` la deja en la caché del sistema
+ * (sobrevive a que el proceso muera); `fdatasync`, agrupado, la lleva
+ * al disco (sobrevive a un corte de luz).
+ */
+void swap_append(const char *input, size_t length)
+{
+    /* `write` puede escribir menos de lo pedido (más de 2 GiB, p. ej.). */
+    while (length > 0) {
+        ssize_t n = write(swap_fd, input, length);
+        if (n <= 0) {
+            perror("Aviso: no se pudo escribir en el diario");
+            break;
+        }
+        input += n;
+        length -= (size_t)n;
+    }
+    swap_unsynced++;
+    double now = now_seconds();
+    if (swap_unsynced >= SWAP_SYNC_EVERY ||
+        now - swap_last_sync >= SWAP_SYNC_SECONDS) {
+        fdatasync(swap_fd);
+        swap_unsynced = 0;
+        swap_last_sync = now;
+    }
+}
+
+/*
+ * Tras guardar, lo anotado antes de `keep_from` ya está en el archivo:
+ * reescribimos el diario con la cabecera de la nueva versión y solo las
+ * órdenes posteriores (las tecleadas mientras se guardaba).
+ */
+void swap_restart(const char *filename, off_t keep_from)
+{
+    if (swap_fd == -1)
+        return;
+    off_t end = lseek(swap_fd, 0, SEEK_END);
+    size_t tail_len = end > keep_from ? (size_t)(end - keep_from) : 0;
+    char *tail = malloc(tail_len + 1);
+    if (!tail || pread(swap_fd, tail, tail_len, keep_from) != (ssize_t)tail_len)
+        tail_len = 0;
+
+    char header[128];
+    int length = swap_header(filename, header, sizeof(header));
+    if (ftruncate(swap_fd, 0) != 0 || write(swap_fd, header, length) != length ||
+        write(swap_fd, tail, tail_len) != (ssize_t)tail_len)
+        perror("Aviso: no se pudo reiniciar el diario");
+    fdatasync(swap_fd);
+    swap_unsynced = 0;
+    free(tail);
+}
+
+/*
+ * El archivo creció por otro lado (vigilancia): la cabecera pasa a
+ * describir la versión nueva y se conservan todas las órdenes anotadas.
+ */
+void swap_rebase(const char *filename)
+{
+    if (swap_fd == -1)
+        return;
+    char header[128];
+    ssize_t n = pread(swap_fd, header, sizeof(header), 0);
+    char *nl = n > 0 ? memchr(header, '\n', n) : NULL;
+    swap_restart(filename, nl ? nl + 1 - header : 0);
+}
+
+/*
+ * Cierra el diario. Al salir con `q` ya no hace falta y se borra; con
+ * `keep` se conserva (y se lleva al disco) para recuperarlo después.
+ */
+void swap_close(bool keep)
+{
+    if (swap_fd == -1)
+        return;
+    if (keep)
+        fdatasync(swap_fd);
+    else
+        unlink(swap_name);
+    close(swap_fd);
+    swap_fd = -1;
+}
+
+/* --- Archivos proyectados que cambian por fuera --- */
+
+/* ¿Está `addr` en una proyección de archivo del buffer dado? */
+bool in_file_map(const char *addr, const char *base, size_t size,
+                 const SpillMap *tails)
+{
+    bool ours = base && addr >= base && addr < base + size;
+    for (const SpillMap *m = tails; m && !ours; m = m->next)
+        ours = addr >= m->base && addr < m->base + m->size;
+    return ours;
+}
+
+/*
+ * Si otro programa trunca un archivo proyectado, leer las páginas que ya
+ * no existen provoca SIGBUS. Las tapamos con una página anónima a cero:
+ * esas líneas quedan en blanco en vez de terminar el programa, y
+ * `map_check` avisa antes de la siguiente orden. Solo se tapan
+ * direcciones de nuestras proyecciones de archivos (las de cualquier
+ * buffer abierto); cualquier otro SIGBUS sigue siendo mortal.
+ */
+void on_sigbus(int sig, siginfo_t *info, void *context)
+{
+    (void)context;
+    char *addr = info->si_addr;
+    bool ours = in_file_map(addr, map_base, map_size, tail_maps);
+    for (int i = 0; i < buffer_count && !ours; i++)
+        if (i != current_buffer) /* La entrada del activo no está al día */
+            ours = in_file_map(addr, buffers[i].map_base,
+                               buffers[i].map_size, buffers[i].tail_maps);
+    /* Escribible: `map_freeze` puede estar copiando esta misma página. */
+    void *page = (void *)((uintptr_t)addr & ~(map_page - 1));
+    if (!ours || mmap(page, map_page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) ==
+                     MAP_FAILED)
+        signal(sig, SIG_DFL); /* Al repetir el acceso, el programa termina */
+    else
+        map_lost = 1;
+}
+
+/* Instala el manejador de SIGBUS (una sola vez) antes de proyectar. */
+void sigbus_install(void)
+{
+    if (map_page)
+        return;
+    struct sigaction action = {0};
+    action.sa_sigaction = on_sigbus;
+    action.sa_flags = SA_SIGINFO;
+    map_page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    sigaction(SIGBUS, &action, NULL);
+}
+
+/*
+ * Apunta de dónde sale una proyección que empieza en `offset` de `fd`:
+ * un duplicado del descriptor, para poder cerrar el original, y el
+ * tamaño y la fecha que tiene ahora el archivo.
+ */
+MapSource map_source_open(int fd, off_t offset)
+{
+    MapSource source = {.fd = -1, .offset = offset};
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return source;
+    source.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    source.size = st.st_size;
+    source.mtime = st.st_mtim;
+    return source;
+}
+
+void map_source_close(MapSource *source)
+{
+    if (source->fd >= 0)
+        close(source->fd);
+    source->fd = -1;
+}
+
+/*
+ * Deja de depender del archivo en [base, base + size). Las páginas que
+ * ya no existen en él (a partir de `keep` bytes) se tapan con ceros; con
+ * `copy`, las demás se copian a memoria propia escribiendo un byte en
+ * cada una: en una proyección MAP_PRIVATE, la primera escritura hace la
+ * copia y el archivo deja de verse a través de ella.
+ */
+void map_freeze(char *base, size_t size, size_t keep, bool copy)
+{
+    size_t span = (size + map_page - 1) & ~(map_page - 1);
+    keep = keep < size ? (keep + map_page - 1) & ~(map_page - 1) : span;
+    if (keep < span)
+        mmap(base + keep, span - keep, PROT_READ,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (!copy || keep == 0 || mprotect(base, keep, PROT_READ | PROT_WRITE) != 0)
+        return;
+    for (size_t offset = 0; offset < keep; offset += map_page) {
+        volatile char *p = base + offset;
+        *p = *p;
+    }
+    mprotect(base, keep, PROT_READ);
+}
+
+/*
+ * Comprueba el archivo de una proyección. Si lo han reescrito (es más
+ * corto, o igual de largo con otra fecha), la congela con `map_freeze`
+ * y devuelve true. Si solo ha crecido, lo proyectado sigue intacto: se
+ * apunta el tamaño nuevo sin avisar. El descriptor es un duplicado del
+ * que se abrió, así que un archivo sustituido con `rename` no cuenta:
+ * el viejo sigue existiendo mientras esté abierto. En modo paginado no
+ * se copia: el límite de memoria no lo permite y las páginas soltadas
+ * se vuelven a leer del disco, así que solo se tapan las perdidas y se
+ * sigue comprobando.
+ */
+bool map_source_check(MapSource *source, char *base, size_t size)
+{
+    struct stat st;
+    if (source->fd < 0 || fstat(source->fd, &st) != 0)
+        return false;
+    bool same_mtime = st.st_mtim.tv_sec == source->mtime.tv_sec &&
+                      st.st_mtim.tv_nsec == source->mtime.tv_nsec;
+    if (st.st_size == source->size && same_mtime)
+        return false;
+    if (st.st_size > source->size) {
+        source->size = st.st_size;
+        source->mtime = st.st_mtim;
+        return false;
+    }
+
+    size_t keep = st.st_size > source->offset
+        ? (size_t)(st.st_size - source->offset) : 0;
+    map_freeze(base, size, keep, page_limit == 0);
+    if (page_limit) {
+        source->size = st.st_size;
+        source->mtime = st.st_mtim;
+    } else {
+        map_source_close(source);
+    }
+    return true;
+}
+
+/*
+ * Antes de cada orden: ¿ha cambiado por fuera algún archivo proyectado
+ * del buffer activo? Con `-w` el archivo abierto es cosa de
+ * `watch_check`; los leídos con `r` se comprueban siempre.
+ */
+void map_check(void)
+{
+    bool changed = false;
+    if (watch_fd == -1)
+        changed = map_source_check(&map_source, map_base, map_size);
+    for (SpillMap *m = tail_maps; m; m = m->next)
+        changed |= map_source_check(&m->source, m->base, m->size);
+    /* Hay líneas cuyo texto cambió sin cambiar de dirección. */
+    if (changed || map_lost)
+        hash_cache_clear();
+
+    if (changed && page_limit)
+        report_error("Aviso: otro programa ha cambiado un archivo del "
+                     "buffer. En modo paginado su texto se sigue leyendo "
+                     "del disco: las líneas sin tocar pueden mostrar ya la "
+                     "versión nueva.");
+    else if (changed)
+        report_error("Aviso: otro programa ha cambiado un archivo del "
+                     "buffer. Las líneas sin tocar pueden mostrar ya la "
+                     "versión nueva, pero desde ahora no cambian más "
+                     "(compruébalo con `diff`).");
+    if (map_lost) {
+        map_lost = 0;
+        report_error("Aviso: parte de un archivo del buffer desapareció "
+                     "mientras se leía (se truncó): esas líneas quedan en "
+                     "blanco.");
+    }
+}
+
+/*
+ * `len` es un `int`: ¿cabe cada línea de `text` en MAX_LINE_BYTES? Solo
+ * hay que recorrerlo si el texto entero no cabe.
+ */
+bool lines_fit(const char *text, size_t len)
+{
+    const char *end = text + len;
+    while ((size_t)(end - text) > MAX_LINE_BYTES) {
+        const char *nl = memchr(text, '\n', end - text);
+        if (!nl || nl - text > MAX_LINE_BYTES)
+            return false;
+        text = nl + 1;
+    }
+    return true;
+}
+
+/* --- Vigilancia del archivo (inotify) --- */
+
+/*
+ * Empieza a vigilar `filename`, del que el buffer ya contiene los
+ * primeros `end` bytes (`tail` de ellos sin '\n' final). Si ya había
+ * una vigilancia (tras guardar, el archivo es otro), la sustituye.
+ */
+bool watch_open(const char *filename, off_t end, off_t tail)
+{
+    if (watch_fd == -1) {
+        watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watch_fd == -1) {
+            perror("Aviso: no se puede vigilar el archivo");
+            return false;
+        }
+    }
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        report_error("Aviso: solo se pueden vigilar archivos regulares "
+                     "existentes; '%s' no se vigila.", filename);
+        if (fd != -1)
+            close(fd);
+        watch_stop();
+        return false;
+    }
+    int wd = inotify_add_watch(watch_fd, filename, IN_MODIFY | IN_ATTRIB |
+                               IN_MOVE_SELF | IN_DELETE_SELF);
+    if (wd == -1) {
+        perror("Aviso: no se puede vigilar el archivo");
+        close(fd);
+        watch_stop();
+        return false;
+    }
+    /* La vigilancia vieja puede haber desaparecido ya con su archivo. */
+    if (watch_wd != -1 && watch_wd != wd)
+        inotify_rm_watch(watch_fd, watch_wd);
+    if (watch_file != -1)
+        close(watch_file);
+    watch_wd = wd;
+    watch_file = fd;
+    snprintf(watch_name, sizeof(watch_name), "%s", filename);
+    watch_end = end;
+    watch_tail = tail;
+    watch_warned = false;
+    return true;
+}
+
+/*
+ * Vigila el archivo recién cargado: lo que hay en el buffer es la
+ * proyección entera (el archivo pudo crecer después de `mmap`).
+ */
+bool watch_start(const char *filename)
+{
+    off_t tail = 0;
+    while (tail < (off_t)map_size && map_base[map_size - tail - 1] != '\n')
+        tail++;
+    return watch_open(filename, (off_t)map_size, tail);
+}
+
+/* Deja de vigilar. */
+void watch_stop(void)
+{
+    if (watch_file != -1)
+        close(watch_file);
+    if (watch_fd != -1)
+        close(watch_fd); /* También retira las vigilancias */
+    watch_fd = watch_wd = watch_file = -1;
+}
+
+/*
+ * Texto del tramo [from, from + len) de `fd`: la cola del archivo
+ * vigilado o un archivo entero leído con `r`. Los tramos grandes se
+ * proyectan; los pequeños se leen con `pread` y se copian a la arena.
+ * Devuelve NULL si no se pudo leer.
+ */
+const char *read_text(int fd, off_t from, size_t *len)
+{
+    if (*len >= READ_MAP_BYTES) {
+        off_t page = sysconf(_SC_PAGESIZE);
+        off_t start = from & ~(page - 1);
+        size_t size = *len + (from - start);
+        sigbus_install();
+        void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, start);
+        SpillMap *map = base != MAP_FAILED ? malloc(sizeof(SpillMap)) : NULL;
+        if (map) {
+            map->base = base;
+            map->size = size;
+            /* La cola del archivo vigilado ya la comprueba `watch_check`. */
+            map->source = fd == watch_file ? (MapSource){.fd = -1}
+                                           : map_source_open(fd, start);
+            map->next = tail_maps;
+            tail_maps = map;
+            return map->base + (from - start);
+        }
+        if (base != MAP_FAILED)
+            munmap(base, size);
+    }
+
+    char *buffer = malloc(*len);
+    size_t done = 0;
+    while (buffer && done < *len) {
+        ssize_t n = pread(fd, buffer + done, *len - done, from + done);
+        if (n <= 0)
+            break; /* Se truncó mientras leíamos: nos quedamos con lo leído */
+        done += n;
+    }
+    const char *text = buffer && done > 0 ? add_text(buffer, done) : NULL;
+    free(buffer);
+    *len = done;
+    return text;
+}
+
+/*
+ * Construye un árbol suelto con las líneas de `text` (`len` bytes, al
+ * menos uno) y suma a `*lines` las que tiene. Se crean igual que al
+ * cargar: bloques en modo paginado, o un nodo por línea enlazados en un
+ * treap en tiempo lineal.
+ */
+Line *text_tree(const char *text, size_t len, int *lines)
+{
+    if (page_limit)
+        return build_blocks(text, len, lines);
+
+    LoadJob job = {0};
+    job.begin = job.line_start = text;
+    job.end = text + len;
+    job.count = count_newlines(text, len) + (text[len - 1] != '\n');
+    if ((long)*lines + job.count > INT_MAX) {
+        fprintf(stderr, "Demasiadas líneas para el editor.\n");
+        exit(1);
+    }
+    job.nodes = new_block(&node_blocks, job.count * sizeof(Line));
+    job.seed = next_priority();
+    build_worker(&job);
+    *lines += (int)job.count;
+    return job.tree;
+}
+
+/*
+ * Añade al final del buffer las líneas de `text`, fuera del historial de
+ * deshacer: son parte del archivo, no una edición.
+ */
+void append_text(const char *text, size_t len)
+{
+    root = merge(root, text_tree(text, len, &line_count));
+}
+
+/*
+ * Compara el archivo vigilado con lo que ya tenemos. Si creció, lee solo
+ * la cola nueva. Si el buffer no tiene cambios, además vuelve a leer la
+ * última línea si estaba a medias. Si el archivo se truncó o se borró,
+ * el buffer ya no se puede poner al día añadiendo líneas.
+ */
+void watch_check(void)
+{
+    struct stat st;
+    if (fstat(watch_file, &st) != 0)
+        return;
+    if (st.st_nlink == 0) {
+        report_error("Aviso: '%s' se ha borrado o sustituido; deja de "
+                     "vigilarse.", watch_name);
+        watch_stop();
+        return;
+    }
+
+    if (st.st_size < watch_end) {
+        if (!modified) {
+            /* Nada que perder: volvemos a cargarlo (como `tail -F`). */
+            char filename[4096];
+            snprintf(filename, sizeof(filename), "%s", watch_name);
+            release_buffer();
+            load_file(filename);
+            if (swap_fd != -1)
+                swap_restart(filename, lseek(swap_fd, 0, SEEK_END));
+            message("'%s' se ha truncado: vuelto a cargar (%d líneas).\n",
+                    filename, line_count);
+            watch_start(filename);
+            return;
+        }
+        report_error("Aviso: '%s' se ha truncado y el buffer tiene cambios: "
+                     "ya no coincide con el disco y las líneas de la parte "
+                     "cortada se han perdido (quedan en blanco).",
+                     watch_name);
+        watch_end = st.st_size;
+        watch_tail = 0;
+        watch_warned = true;
+        return;
+    }
+    if (st.st_size == watch_end)
+        return;
+
+    off_t grown = st.st_size - watch_end;
+    bool reread = watch_tail > 0 && !modified;
+    off_t from = reread ? watch_end - watch_tail : watch_end;
+    size_t len = (size_t)(st.st_size - from);
+    const char *text = read_text(watch_file, from, &len);
+    if (!text) {
+        perror("Aviso: no se pudo leer lo añadido al archivo");
+        return;
+    }
+    if (!lines_fit(text, len)) {
+        report_error("Aviso: lo añadido a '%s' tiene una línea de más de %d "
+                     "bytes; deja de vigilarse.", watch_name, MAX_LINE_BYTES);
+        watch_stop();
+        return;
+    }
+    int before = line_count;
+    if (reread)
+        recycle_tree(detach_lines(line_count, 1)); /* La versión a medias */
+    append_text(text, len);
+    cursor_line = NULL;
+
+    watch_end = from + (off_t)len;
+    watch_tail = 0;
+    while (watch_tail < (off_t)len && text[len - watch_tail - 1] != '\n')
+        watch_tail++;
+    swap_rebase(watch_name);
+
+    message("'%s' ha crecido %lld bytes: %d líneas nuevas (%d en total).\n",
+            watch_name, (long long)grown, line_count - before, line_count);
+    if (modified && !watch_warned) {
+        report_error("Aviso: el buffer tiene cambios sin guardar; lo nuevo "
+                     "se añade al final, pero puede no coincidir con el "
+                     "disco (compruébalo con `diff`).");
+        watch_warned = true;
+    }
+}
+
+/*
+ * Atiende los avisos de inotify pendientes (sin esperar). Los avisos
+ * solo dicen "algo cambió": `watch_check` mira el tamaño y decide. Con
+ * un guardado en curso se espera a que termine, porque `rename` está a
+ * punto de sustituir el archivo. Devuelve true si había avisos.
+ */
+bool watch_poll(void)
+{
+    if (watch_fd == -1)
+        return false;
+    char events[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool pending = false;
+    while (read(watch_fd, events, sizeof(events)) > 0)
+        pending = true;
+    if (pending && !save_job)
+        watch_check();
+    return pending;
+}
+
+/*
+ * En una sesión interactiva, espera la siguiente orden atendiendo
+ * mientras tanto los cambios del archivo: así un log que crece aparece
+ * en el buffer aunque no se teclee nada. Tras cada aviso se vuelve a
+ * mostrar el indicador.
+ */
+void watch_wait_input(void)
+{
+    while (watch_fd != -1) {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0},
+                                {watch_fd, POLLIN, 0}};
+        fflush(stdout);
+        if (poll(fds, 2, -1) == -1 && errno != EINTR)
+            return;
+        if (fds[0].revents)
+            return; /* Hay una orden (o fin de la entrada) */
+        if (fds[1].revents) {
+            message("\r");
+            save_poll();
+            watch_poll();
+            message("> ");
+        }
+    }
+}
+
+/* --- Varios archivos abiertos y registro de copiado --- */
+
+/* Copia en `b` el estado del buffer activo (las variables globales). */
+void buffer_stash(Buffer *b)
+{
+    b->root = root;
+    b->line_count = line_count;
+    b->modified = modified;
+    b->cursor_line = cursor_line;
+    b->cursor_index = cursor_index;
+    b->map_base = map_base;
+    b->map_size = map_size;
+    b->map_source = map_source;
+    b->line_nodes = line_nodes;
+    memcpy(b->hot_ring, hot_ring, sizeof(hot_ring));
+    b->hot_next = hot_next;
+    b->spill_fd = spill_fd;
+    b->spill_size = spill_size;
+    b->spill_maps = spill_maps;
+    b->journal = journal;
+    b->journal_len = journal_len;
+    b->journal_pos = journal_pos;
+    b->journal_capacity = journal_capacity;
+    b->swap_fd = swap_fd;
+    memcpy(b->swap_name, swap_name, sizeof(swap_name));
+    b->swap_unsynced = swap_unsynced;
+    b->swap_last_sync = swap_last_sync;
+    b->watch_fd = watch_fd;
+    b->watch_wd = watch_wd;
+    b->watch_file = watch_file;
+    memcpy(b->watch_name, watch_name, sizeof(watch_name));
+    b->watch_end = watch_end;
+    b->watch_tail = watch_tail;
+    b->watch_warned = watch_warned;
+    b->tail_maps = tail_maps;
+}
+
+/* Lo contrario: pone en las variables globales el estado de `b`. */
+void buffer_load(const Buffer *b)
+{
+    root = b->root;
+    line_count = b->line_count;
+    modified = b->modified;
+    cursor_line = b->cursor_line;
+    cursor_index = b->cursor_index;
+    map_base = b->map_base;
+    map_size = b->map_size;
+    map_source = b->map_source;
+    line_nodes = b->line_nodes;
+    memcpy(hot_ring, b->hot_ring, sizeof(hot_ring));
+    hot_next = b->hot_next;
+    spill_fd = b->spill_fd;
+    spill_size = b->spill_size;
+    spill_maps = b->spill_maps;
+    journal = b->journal;
+    journal_len = b->journal_len;
+    journal_pos = b->journal_pos;
+    journal_capacity = b->journal_capacity;
+    swap_fd = b->swap_fd;
+    memcpy(swap_name, b->swap_name, sizeof(swap_name));
+    swap_unsynced = b->swap_unsynced;
+    swap_last_sync = b->swap_last_sync;
+    watch_fd = b->watch_fd;
+    watch_wd = b->watch_wd;
+    watch_file = b->watch_file;
+    memcpy(watch_name, b->watch_name, sizeof(watch_name));
+    watch_end = b->watch_end;
+    watch_tail = b->watch_tail;
+    watch_warned = b->watch_warned;
+    tail_maps = b->tail_maps;
+}
+
+/*
+ * Hace activo el buffer `index`. Antes hay que esperar al guardado en
+ * curso: al terminar toca el diario y la vigilancia del buffer activo.
+ */
+void buffer_activate(int index)
+{
+    if (index == current_buffer)
+        return;
+    save_wait();
+    buffer_stash(&buffers[current_buffer]);
+    buffer_load(&buffers[index]);
+    current_buffer = index;
+}
+
+/* `b n`: pasa al archivo número `n` de la lista. */
+bool buffer_switch(int index)
+{
+    if (index < 0 || index >= buffer_count)
+        return report_error("Error: no hay ningún archivo %d abierto.",
+                            index + 1);
+    buffer_activate(index);
+    message("%d: '%s' (%d líneas%s).\n", index + 1, buffers[index].filename,
+            line_count, modified ? ", con cambios" : "");
+    return true;
+}
+
+/*
+ * `o archivo`: lo abre en un buffer nuevo y pasa a él (si ya estaba
+ * abierto, solo pasa a él). Se carga y se recupera igual que el archivo
+ * de la línea de órdenes; sus nodos salen del pool común.
+ */
+bool open_buffer(const char *path)
+{
+    for (int i = 0; i < buffer_count; i++)
+        if (strcmp(buffers[i].filename, path) == 0)
+            return buffer_switch(i);
+
+    if (buffer_count == buffer_capacity) {
+        buffer_capacity *= 2;
+        buffers = realloc(buffers, buffer_capacity * sizeof(Buffer));
+        if (!buffers) {
+            perror("realloc falló para los buffers");
+            exit(1);
+        }
+    }
+    save_wait();
+    buffer_stash(&buffers[current_buffer]);
+
+    /* Un buffer vacío, sin archivo proyectado, diario ni vigilancia. */
+    Buffer *b = &buffers[buffer_count];
+    memset(b, 0, sizeof(Buffer));
+    b->spill_fd = b->swap_fd = b->map_source.fd = -1;
+    b->watch_fd = b->watch_wd = b->watch_file = -1;
+    b->filename = strdup(path);
+    buffer_load(b);
+    current_buffer = buffer_count++;
+
+    load_file(path);
+    if (!batch_mode) {
+        swap_recover(path);
+        swap_open(path);
+    }
+    message("%d: '%s' (%d líneas).\n", current_buffer + 1, path, line_count);
+    return true;
+}
+
+/* `b`: lista los archivos abiertos; el activo lleva un '*'. */
+bool list_buffers(void)
+{
+    buffer_stash(&buffers[current_buffer]); /* Poner al día su entrada */
+    for (int i = 0; i < buffer_count; i++) {
+        const Buffer *b = &buffers[i];
+        printf("%c%3d  %-30s %9d líneas%s\n", i == current_buffer ? '*' : ' ',
+               i + 1, b->filename, b->line_count,
+               b->modified ? "  (con cambios)" : "");
+    }
+    if (yank_lines > 0)
+        printf("Registro: %d líneas.\n", yank_lines);
+    return true;
+}
+
+/*
+ * Antes de salir, pregunta por cada archivo con cambios sin guardar. Con
+ * un solo archivo, la pregunta de siempre.
+ */
+void confirm_quit(void)
+{
+    for (int i = 0; i < buffer_count; i++) {
+        buffer_activate(i);
+        if (!modified)
+            continue;
+        char answer[16];
+        if (buffer_count == 1)
+            printf("Hay cambios sin guardar. ¿Deseas guardar? (y/n): ");
+        else
+            printf("Hay cambios sin guardar en '%s'. ¿Deseas guardar? "
+                   "(y/n): ", buffers[i].filename);
+        if (fgets(answer, sizeof(answer), stdin) != NULL &&
+            (answer[0] == 'y' || answer[0] == 'Y'))
+            save_file(buffers[i].filename);
+    }
+}
+
+/*
+ * Al terminar, cierra el diario y la vigilancia de cada archivo y lo
+ * libera todo. Si la entrada se cortó con cambios sin guardar, el diario
+ * de ese archivo se queda para recuperarlos.
+ */
+void close_buffers(bool quit)
+{
+    for (int i = 0; i < buffer_count; i++) {
+        buffer_activate(i);
+        swap_close(!quit && modified);
+        watch_stop();
+        release_buffer();
+        free(buffers[i].filename);
+    }
+    free_buffer();
+    free(buffers);
+    buffers = NULL;
+    buffer_count = buffer_capacity = 0;
+}
+
+/*
+ * `y a,b`: copia las líneas al registro. El texto se interna en la arena
+ * común, así el registro no depende del archivo de origen (que puede
+ * estar proyectado o paginado) y se puede pegar en cualquier otro; las
+ * líneas repetidas, aquí o entre archivos, se guardan una vez.
+ */
+bool yank_range(int first, int last)
+{
+    if (first < 1 || last > line_count || first > last)
+        return report_error("Error: rango inválido.");
+
+    yank_clear();
+    TreapBuilder builder = {0};
+    LineIter it;
+    iter_seek(&it, first);
+    do {
+        Line *line = create_line_ref(intern_text(it.text, it.len), it.len);
+        line->flags = LINE_OWNED | LINE_NL;
+        builder_push(&builder, line);
+    } while (it.number < last && iter_next(&it));
+    yank_tree = builder_finish(&builder);
+    yank_lines = last - first + 1;
+    message("%d líneas copiadas al registro.\n", yank_lines);
+    return true;
+}
+
+/* Vacía el registro; sus nodos vuelven al pool. */
+void yank_clear(void)
+{
+    recycle_tree(yank_tree);
+    yank_tree = NULL;
+    yank_lines = 0;
+}
+
+/* Añade una línea al final del registro (orden `Y` del diario). */
+void yank_push(const char *text)
+{
+    yank_tree = merge(yank_tree, create_line(text));
+    yank_lines++;
+}
+
+/*
+ * El diario de recuperación guarda las órdenes tal cual, pero `x` depende
+ * del registro, que pudo llenarse en otro archivo. Antes de cada `x` se
+ * anota el contenido del registro como órdenes `Y` que lo reconstruyen.
+ */
+void swap_yank(void)
+{
+    Line *first = yank_tree;
+    while (first->left)
+        first = first->left;
+    size_t size = 2;
+    for (Line *line = first; line; line = next_line(line))
+        size += line->len + 3;
+
+    char *out = malloc(size);
+    if (!out) {
+        perror("malloc falló para el diario");
+        exit(1);
+    }
+    memcpy(out, "Y\n", 2);
+    size_t len = 2;
+    for (Line *line = first; line; line = next_line(line)) {
+        out[len++] = 'Y';
+        out[len++] = ' ';
+        memcpy(out + len, line->text, line->len);
+        len += line->len;
+        out[len++] = '\n';
+    }
+    swap_append(out, len);
+    free(out);
+}
+
+/*
+ * `x n`: pega el registro tras la línea `n`. Se pega una copia de los
+ * nodos (el texto se comparte) y se engancha de una vez, en O(log n).
+ */
+bool put_lines(int after)
+{
+    if (after < 0 || after > line_count)
+        return report_error("Error: número de línea inválido.");
+    if (!yank_tree)
+        return report_error("Error: el registro está vacío.");
+    if ((long)line_count + yank_lines > INT_MAX)
+        return report_error("Error: demasiadas líneas para el editor.");
+
+    if (swap_fd != -1)
+        swap_yank();
+    attach_lines(clone_tree(yank_tree), after);
+    journal_push(UNDO_INSERT, after + 1, yank_lines, NULL);
+    modified = true;
+    return true;
+}
+
+/* --- Estadísticas e instrumentación --- */
+
+/* Nanosegundos en un reloj monotónico. */
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*
+ * Cubo del histograma para `v`. Los valores menores que 8 tienen cubo
+ * propio; a partir de ahí, el exponente (posición del bit más alto) elige
+ * el grupo y los 3 bits siguientes el cubo dentro de él.
+ */
+int hist_index(uint64_t v)
+{
+    const int sub = 1 << HIST_SUB_BITS;
+    if (v < (uint64_t)sub)
+        return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+           + (int)((v >> (e - HIST_SUB_BITS)) & (sub - 1));
+}
+
+/* Valor más pequeño que cae en el cubo `i` (inversa de `hist_index`). */
+uint64_t hist_lower(int i)
+{
+    const int sub = 1 << HIST_SUB_BITS;
+    if (i < sub)
+        return i;
+    int e = (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (uint64_t)(sub + (i & (sub - 1))) << (e - HIST_SUB_BITS);
+}
+
+/* Valor más grande del cubo `i`. */
+uint64_t hist_upper(int i)
+{
+    return i + 1 < HIST_BUCKETS ? hist_lower(i + 1) - 1 : UINT64_MAX;
+}
+
+/*
+ * Percentil `q` (entre 0 y 1) a partir del histograma. Devolvemos el
+ * límite superior del cubo (nunca por encima del máximo visto), así que
+ * el error es el ancho del cubo: menos de un 12,5%.
+ */
+uint64_t hist_percentile(const CommandStats *s, double q)
+{
+    uint64_t rank = (uint64_t)(q * s->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += s->buckets[i];
+        if (seen >= rank)
+            return hist_upper(i) < s->max_ns ? hist_upper(i) : s->max_ns;
+    }
+    return s->max_ns;
+}
+
+/*
+ * Nombre con el que se agrupan las estadísticas de una orden. Sigue el
+ * mismo reparto que `run_command`; las líneas vacías y los comentarios de
+ * los guiones no cuentan.
+ */
+const char *command_name(const char *input)
+{
+    switch (input[0]) {
+    case '\n':
+    case '\0':
+    case '#':
+        return NULL;
+    case 'p': return "p";
+    case 'a': return "a";
+    case 'i': return "i";
+    case 'd': return strncmp(input, "diff", 4) == 0 ? "diff" : "d";
+    case 'm': return "m";
+    case 't': return "t";
+    case 's':
+        if (input[1] == '/')
+            return "s///";
+        if (strncmp(input, "stats", 5) == 0)
+            return "stats";
+        if (strncmp(input, "sort", 4) == 0)
+            return "sort";
+        return "s";
+    case '/': return "/";
+    case 'g': return "g//";
+    case 'u': return strncmp(input, "uniq", 4) == 0 ? "uniq" : "u";
+    case 'U': return "U";
+    case 'r': return "r";
+    case 'o': return "o";
+    case 'b': return "b";
+    case 'y': return "y";
+    case 'x': return "x";
+    case 'e': return "e";
+    case 'h': return "h";
+    case 'q': return "q";
+    default: return "?";
+    }
+}
+
+/*
+ * Anota que una orden tardó `ns` nanosegundos. Con `--trace`, le asigna
+ * también el reparto por fases que se fue acumulando mientras corría.
+ */
+void stats_record(const char *name, uint64_t ns)
+{
+    CommandStats *s = NULL;
+    for (int i = 0; i < command_kinds && !s; i++)
+        if (strcmp(command_stats[i].name, name) == 0)
+            s = &command_stats[i];
+    if (!s && command_kinds < MAX_COMMAND_KINDS) {
+        s = &command_stats[command_kinds++];
+        s->name = name;
+    }
+    if (s) {
+        s->count++;
+        s->total_ns += ns;
+        if (ns > s->max_ns)
+            s->max_ns = ns;
+        s->buckets[hist_index(ns)]++;
+        for (int p = 0; p < PHASE_COUNT; p++)
+            s->phase_ns[p] += phase_ns[p];
+    }
+    memset(phase_ns, 0, sizeof(phase_ns));
+}
+
+/*
+ * Fases con `--trace`. El tiempo se reparte de forma EXCLUSIVA: al entrar
+ * en una fase, lo transcurrido desde la última marca se carga a la fase
+ * que estaba encima de la pila (si la había), y al salir se carga a la
+ * que se cierra. Así una reserva dentro de una escritura no se cuenta
+ * dos veces. Solo se instrumenta código del hilo principal.
+ */
+void trace_enter(int phase)
+{
+    if (!trace_on)
+        return;
+    uint64_t now = now_ns();
+    if (phase_depth > 0)
+        phase_ns[phase_stack[phase_depth - 1]] += now - phase_mark;
+    if (phase_depth < (int)(sizeof(phase_stack) / sizeof(phase_stack[0])))
+        phase_stack[phase_depth] = phase;
+    phase_depth++;
+    phase_mark = now;
+}
+
+void trace_leave(void)
+{
+    if (!trace_on)
+        return;
+    uint64_t now = now_ns();
+    phase_depth--;
+    if (phase_depth < (int)(sizeof(phase_stack) / sizeof(phase_stack[0])))
+        phase_ns[phase_stack[phase_depth]] += now - phase_mark;
+    phase_mark = now;
+}
+
+/* Escribe una duración con la unidad que le corresponde. */
+void format_ns(char *out, size_t size, uint64_t ns)
+{
+    if (ns < 10000)
+        snprintf(out, size, "%lu ns", (unsigned long)ns);
+    else if (ns < 10000000)
+        snprintf(out, size, "%.1f µs", ns / 1e3);
+    else if (ns < 10000000000ull)
+        snprintf(out, size, "%.1f ms", ns / 1e6);
+    else
+        snprintf(out, size, "%.1f s", ns / 1e9);
+}
+
+/* Lo que ocupa el buffer ahora mismo (un recorrido del árbol). */
+typedef struct {
+    long nodes, blocks;        /* `blocks`: nodos de varias líneas (`-m`) */
+    size_t text_bytes;         /* Texto del buffer, con sus '\n' */
+    size_t owned_bytes;        /* ...de él, el que vive en la arena */
+    size_t tail_bytes;         /* Colas proyectadas por `-w` */
+    size_t rss, peak_rss;
+} MemoryStats;
+
+void count_tree(const Line *node, MemoryStats *m)
+{
+    while (node) {
+        m->nodes++;
+        if (node->weight > 1)
+            m->blocks++;
+        m->text_bytes += node->len + 1;
+        if (node->flags & LINE_OWNED)
+            m->owned_bytes += node->len + 1;
+        count_tree(node->left, m);
+        node = node->right;
+    }
+}
+
+void collect_memory(MemoryStats *m)
+{
+    *m = (MemoryStats){0};
+    count_tree(root, m);
+    for (SpillMap *map = tail_maps; map; map = map->next)
+        m->tail_bytes += map->size;
+
+    /* /proc/self/statm: el segundo campo son las páginas residentes. */
+    FILE *statm = fopen("/proc/self/statm", "r");
+    unsigned long pages;
+    if (statm && fscanf(statm, "%*s %lu", &pages) == 1)
+        m->rss = pages * (size_t)sysconf(_SC_PAGESIZE);
+    if (statm)
+        fclose(statm);
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        m->peak_rss = (size_t)usage.ru_maxrss * 1024;
+}
+
+/* Megabytes por segundo, o 0 si no se midió nada. */
+double throughput(size_t bytes, double seconds)
+{
+    return seconds > 0 ? bytes / 1e6 / seconds : 0;
+}
+
+/*
+ * `stats`: tabla de latencias por orden (las de `stats` incluidas, salvo
+ * la que se está ejecutando) y resumen de memoria, carga y guardados.
+ */
+bool print_stats(void)
+{
+    const double mb = 1e6;
+    MemoryStats m;
+    collect_memory(&m);
+
+    printf("%-6s %8s %10s %10s %10s %10s %10s\n",
+           "orden", "veces", "media", "p50", "p90", "p99", "máx");
+    for (int i = 0; i < command_kinds; i++) {
+        const CommandStats *s = &command_stats[i];
+        char mean[32], p50[32], p90[32], p99[32], max[32];
+        format_ns(mean, sizeof(mean), s->total_ns / s->count);
+        format_ns(p50, sizeof(p50), hist_percentile(s, 0.50));
+        format_ns(p90, sizeof(p90), hist_percentile(s, 0.90));
+        format_ns(p99, sizeof(p99), hist_percentile(s, 0.99));
+        format_ns(max, sizeof(max), s->max_ns);
+        printf("%-6s %8lu %10s %10s %10s %10s %10s\n", s->name,
+               (unsigned long)s->count, mean, p50, p90, p99, max);
+        if (trace_on && s->total_ns > 0) {
+            uint64_t rest = s->total_ns;
+            for (int p = 0; p < PHASE_COUNT; p++)
+                rest -= s->phase_ns[p] < rest ? s->phase_ns[p] : rest;
+            printf("       árbol %.0f%%, memoria %.0f%%, salida %.0f%%, "
+                   "resto %.0f%%\n",
+                   100.0 * s->phase_ns[PHASE_TREE] / s->total_ns,
+                   100.0 * s->phase_ns[PHASE_ALLOC] / s->total_ns,
+                   100.0 * s->phase_ns[PHASE_OUTPUT] / s->total_ns,
+                   100.0 * rest / s->total_ns);
+        }
+    }
+
+    printf("Líneas: %d en %ld nodos de %zu bytes (%ld bloques de `-m`)\n",
+           line_count, m.nodes, sizeof(Line), m.blocks);
+    printf("Pool de nodos: %.1f MB (%.0f%% en el buffer)\n", pool_bytes / mb,
+           pool_bytes ? 100.0 * m.nodes * sizeof(Line) / pool_bytes : 0);
+    printf("Texto: %.1f MB; en la arena %.1f MB de %.1f MB reservados\n",
+           m.text_bytes / mb, m.owned_bytes / mb, arena_bytes / mb);
+    printf("Historial: %d registros (%.1f MB)\n", journal_len,
+           journal_capacity * sizeof(UndoRecord) / mb);
+    printf("Archivos abiertos: %d; registro: %d líneas; textos internados: "
+           "%zu (%.1f MB sin duplicar)\n", buffer_count, yank_lines,
+           intern_count, intern_saved / mb);
+    printf("Proyecciones: archivo %.1f MB, colas %.1f MB, spill %.1f MB\n",
+           map_size / mb, m.tail_bytes / mb, spill_size / mb);
+    printf("Memoria residente: %.1f MB (pico %.1f MB)\n",
+           m.rss / mb, m.peak_rss / mb);
+    printf("Carga: %.1f MB en %.3f s (%.0f MB/s)\n", load_bytes / mb,
+           load_seconds, throughput(load_bytes, load_seconds));
+    printf("Guardados: %d, %.1f MB en %.3f s (%.0f MB/s)\n", save_count,
+           save_bytes / mb, save_seconds,
+           throughput(save_bytes, save_seconds));
+    return true;
+}
+
+/*
+ * `--trace`: al salir vuelca las mismas cifras que `stats` en JSON, con
+ * el histograma completo (solo los cubos no vacíos, como
+ * `[desde_ns, hasta_ns, veces]`) para poder dibujarlo o compararlo
+ * entre versiones.
+ */
+bool write_trace(const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        perror("No se pudo crear el archivo de traza");
+        return false;
+    }
+    MemoryStats m;
+    collect_memory(&m);
+
+    fprintf(out, "{\n  \"buffer\": {\"lines\": %d, \"nodes\": %ld, "
+            "\"blocks\": %ld, \"node_bytes\": %zu, \"text_bytes\": %zu, "
+            "\"arena_text_bytes\": %zu},\n",
+            line_count, m.nodes, m.blocks, sizeof(Line), m.text_bytes,
+            m.owned_bytes);
+    fprintf(out, "  \"memory\": {\"node_pool_bytes\": %zu, "
+            "\"arena_bytes\": %zu, \"undo_records\": %d, \"undo_bytes\": %zu, "
+            "\"map_bytes\": %zu, \"tail_map_bytes\": %zu, "
+            "\"spill_bytes\": %lld, \"rss_bytes\": %zu, "
+            "\"peak_rss_bytes\": %zu, \"buffers\": %d, "
+            "\"interned_texts\": %zu, \"intern_saved_bytes\": %zu},\n",
+            pool_bytes, arena_bytes, journal_len,
+            journal_capacity * sizeof(UndoRecord), map_size, m.tail_bytes,
+            (long long)spill_size, m.rss, m.peak_rss, buffer_count,
+            intern_count, intern_saved);
+    fprintf(out, "  \"load\": {\"bytes\": %zu, \"seconds\": %.6f, "
+            "\"mb_per_s\": %.1f},\n",
+            load_bytes, load_seconds, throughput(load_bytes, load_seconds));
+    fprintf(out, "  \"save\": {\"count\": %d, \"bytes\": %zu, "
+            "\"seconds\": %.6f, \"mb_per_s\": %.1f},\n",
+            save_count, save_bytes, save_seconds,
+            throughput(save_bytes, save_seconds));
+
+    fprintf(out, "  \"commands\": {");
+    for (int i = 0; i < command_kinds; i++) {
+        const CommandStats *s = &command_stats[i];
+        fprintf(out, "%s\n    \"%s\": {\"count\": %lu, \"total_ns\": %lu, "
+                "\"mean_ns\": %lu, \"p50_ns\": %lu, \"p90_ns\": %lu, "
+                "\"p99_ns\": %lu, \"max_ns\": %lu,\n",
+                i ? "," : "", s->name, (unsigned long)s->count,
+                (unsigned long)s->total_ns,
+                (unsigned long)(s->total_ns / s->count),
+                (unsigned long)hist_percentile(s, 0.50),
+                (unsigned long)hist_percentile(s, 0.90),
+                (unsigned long)hist_percentile(s, 0.99),
+                (unsigned long)s->max_ns);
+        fprintf(out, "      \"phases_ns\": {\"tree\": %lu, \"alloc\": %lu, "
+                "\"output\": %lu},\n      \"histogram\": [",
+                (unsigned long)s->phase_ns[PHASE_TREE],
+                (unsigned long)s->phase_ns[PHASE_ALLOC],
+                (unsigned long)s->phase_ns[PHASE_OUTPUT]);
+        bool first = true;
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            if (!s->buckets[b])
+                continue;
+            fprintf(out, "%s[%lu, %lu, %lu]", first ? "" : ", ",
+                    (unsigned long)hist_lower(b), (unsigned long)hist_upper(b),
+                    (unsigned long)s->buckets[b]);
+            first = false;
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n  }\n}\n");
+    if (fclose(out) != 0) {
+        perror("No se pudo escribir el archivo de traza");
+        return false;
+    }
+    return true;
+}
+
+/* --- Búsqueda y sustitución --- */
+
+/*
+ * Búsqueda de subcadenas, versión escalar: `memchr` salta hasta cada
+ * aparición del primer byte y `memcmp` comprueba el resto.
+ */
+const char *search_scalar(const char *hay, size_t n,
+                          const char *needle, size_t m)
+{
+    if (m == 0)
+        return hay;
+    if (m > n)
+        return NULL;
+
+    const char *p = hay;
+    const char *end = hay + n - m + 1;
+    while (p < end) {
+        p = memchr(p, needle[0], end - p);
+        if (!p)
+            return NULL;
+        if (memcmp(p + 1, needle + 1, m - 1) == 0)
+            return p;
+        p++;
+    }
+    return NULL;
+}
+
+#ifdef SLED_X86
+/*
+ * Versiones vectoriales (SIMD). Comparamos 16 (SSE2) o 32 (AVX2)
+ * posiciones a la vez: una carga empieza en `i` y se compara con el
+ * PRIMER byte del patrón; otra empieza en `i + m - 1` y se compara con el
+ * ÚLTIMO. Solo las posiciones que aciertan en ambos extremos (un bit a 1
+ * en `mask`) pasan a la comprobación completa con `memcmp`.
+ */
+const char *search_sse2(const char *hay, size_t n,
+                        const char *needle, size_t m)
+{
+    if (m < 2 || m > n)
+        return search_scalar(hay, n, needle, m);
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0)
+                return hay + i + bit;
+            mask &= mask - 1; /* Borrar el bit ya comprobado */
+        }
+    }
+    return search_scalar(hay + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+const char *search_avx2(const char *hay, size_t n,
+                        const char *needle, size_t m)
+{
+    if (m < 2 || m > n)
+        return search_scalar(hay, n, needle, m);
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0)
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return search_sse2(hay + i, n - i, needle, m);
+}
+#endif
+
+/*
+ * Elige la mejor búsqueda para la CPU en la que estamos ejecutando
+ * (despacho en tiempo de ejecución): el mismo binario aprovecha AVX2 si
+ * existe y se conforma con SSE2 (o la versión escalar) si no.
+ */
+void init_search(void)
+{
+#ifdef SLED_X86
+    __builtin_cpu_init();
+    search_text = __builtin_cpu_supports("avx2") ? search_avx2 : search_sse2;
+#else
+    search_text = search_scalar;
+#endif
+}
+
+/*
+ * Recorta un patrón delimitado por '/' en su sitio: devuelve el texto
+ * que empieza en `*cursor` y deja `*cursor` tras la '/' de cierre (o al
+ * final si no la hay).
+ */
+char *take_pattern(char **cursor)
+{
+    char *start = *cursor;
+    char *slash = strchr(start, '/');
+    if (slash) {
+        *slash = '\0';
+        *cursor = slash + 1;
+    } else {
+        start[strcspn(start, "\n")] = '\0';
+        *cursor = start + strlen(start);
+    }
+    return start;
+}
+
+/*
+ * `/patrón`: busca la siguiente línea que lo contiene a partir del
+ * cursor, dando la vuelta al final del buffer como hace `ed`.
+ */
+bool find_next(const char *pattern)
+{
+    size_t m = strlen(pattern);
+    if (m == 0 || line_count == 0)
+        return report_error("Error: patrón vacío o buffer vacío.");
+
+    int start = cursor_line ? cursor_index : 0;
+    LineIter it;
+    iter_seek(&it, start % line_count + 1);
+    for (int step = 0; step < line_count; step++) {
+        if (search_text(it.text, it.len, pattern, m)) {
+            trace_enter(PHASE_OUTPUT);
+            printf("%4d: %.*s\n", it.number, it.len, it.text);
+            trace_leave();
+            find_line(it.number); /* Mover el cursor a la coincidencia */
+            return true;
+        }
+        if (!iter_next(&it))
+            iter_seek(&it, 1);
+    }
+    return report_error("Patrón no encontrado.");
+}
+
+/* `g/patrón/`: lista todas las líneas que contienen el patrón. */
+bool list_matches(const char *pattern)
+{
+    size_t m = strlen(pattern);
+    if (m == 0)
+        return report_error("Error: patrón vacío.");
+
+    int found = 0;
+    LineIter it;
+    if (line_count > 0) {
+        iter_seek(&it, 1);
+        list_begin();
+        bool more = true;
+        do {
+            if (search_text(it.text, it.len, pattern, m)) {
+                trace_enter(PHASE_OUTPUT);
+                more = list_line(it.number, it.text, it.len);
+                trace_leave();
+                found++;
+            }
+        } while (more && iter_next(&it));
+        list_end();
+    }
+    if (found == 0)
+        message("Patrón no encontrado.\n");
+    return true;
+}
+
+/* Una línea modificada: su nodo, su número y su texto nuevo en `out`. */
+typedef struct {
+    Line *line;
+    int number;
+    size_t offset;
+} SubstHit;
+
+/*
+ * Trabajo de sustitución para un hilo: un tramo de líneas y los
+ * resultados que produce. Los textos nuevos se acumulan en `out` y cada
+ * línea modificada guarda su desplazamiento y longitud.
+ */
+typedef struct {
+    int first, last;           /* Tramo de líneas a revisar */
+    const char *old_text, *new_text;
+    size_t old_len, new_len;
+    SubstHit *hits;            /* Líneas modificadas */
+    int hit_count, hit_capacity;
+    char *out;
+    size_t out_len, out_capacity;
+    long replacements;
+} SubstJob;
+
+/* Garantiza hueco para `extra` bytes más en la salida del trabajo. */
+void job_reserve(SubstJob *job, size_t extra)
+{
+    if (job->out_len + extra <= job->out_capacity)
+        return;
+    size_t capacity = job->out_capacity ? job->out_capacity : 4096;
+    while (capacity < job->out_len + extra)
+        capacity *= 2;
+    job->out = realloc(job->out, capacity);
+    if (!job->out) {
+        perror("realloc falló en la sustitución");
+        exit(1);
+    }
+    job->out_capacity = capacity;
+}
+
+/* Añade `len` bytes a la salida del trabajo. */
+void job_append(SubstJob *job, const char *text, size_t len)
+{
+    if (len == 0)
+        return;
+    job_reserve(job, len);
+    memcpy(job->out + job->out_len, text, len);
+    job->out_len += len;
+}
+
+/*
+ * Cuerpo de cada hilo: recorre su tramo (solo lectura del árbol) y, en
+ * cada línea con coincidencias, construye el texto sustituido. Las líneas
+ * sin coincidencias no se tocan.
+ */
+void *subst_worker(void *arg)
+{
+    SubstJob *job = arg;
+    int k;
+    Line *line = locate_line(job->first, &k);
+    for (; line && k <= job->last; k += line->weight, line = next_line(line)) {
+        if (line->weight > 1)
+            continue; /* Los bloques se sustituyen en `substitute_blocks` */
+        const char *p = line->text;
+        const char *end = line->text + line->len;
+        const char *hit = search_text(p, end - p, job->old_text, job->old_len);
+        if (!hit)
+            continue;
+
+        if (job->hit_count == job->hit_capacity) {
+            job->hit_capacity = job->hit_capacity ? job->hit_capacity * 2 : 64;
+            job->hits = realloc(job->hits,
+                                job->hit_capacity * sizeof(SubstHit));
+            if (!job->hits) {
+                perror("realloc falló en la sustitución");
+                exit(1);
+            }
+        }
+        job->hits[job->hit_count++] = (SubstHit){line, k, job->out_len};
+        /*
+         * Reservar ya la salida: si la sustitución borra la línea entera
+         * no se añade nada, y `out` no puede quedarse en NULL.
+         */
+        job_reserve(job, line->len + 1);
+
+        while (hit) {
+            job_append(job, p, hit - p);
+            job_append(job, job->new_text, job->new_len);
+            job->replacements++;
+            p = hit + job->old_len;
+            hit = search_text(p, end - p, job->old_text, job->old_len);
+        }
+        job_append(job, p, end - p);
+    }
+    return NULL;
+}
+
+/*
+ * En modo paginado, sustituye dentro de los bloques sin desplegarlos: el
+ * texto nuevo de cada bloque afectado se escribe en el spill y el bloque
+ * pasa a apuntar allí. Devuelve cuántas líneas cambiaron.
+ */
+long substitute_blocks(SubstJob *job)
+{
+    long lines_changed = 0;
+    int k = 1;
+    for (Line *node = first_line(); node; k += node->weight,
+             node = next_line(node)) {
+        if (node->weight == 1)
+            continue;
+        const char *p = node->text;
+        const char *end = node->text + node->len;
+        const char *hit = search_text(p, end - p, job->old_text, job->old_len);
+        if (!hit) {
+            release_text(node->text, node->len);
+            continue;
+        }
+
+        job->out_len = 0;
+        const char *line_end = NULL; /* Fin de la última línea contada */
+        while (hit) {
+            if (!line_end || hit > line_end) {
+                lines_changed++;
+                line_end = memchr(hit, '\n', end - hit);
+                if (!line_end)
+                    line_end = end;
+            }
+            job_append(job, p, hit - p);
+            job_append(job, job->new_text, job->new_len);
+            job->replacements++;
+            p = hit + job->old_len;
+            hit = search_text(p, end - p, job->old_text, job->old_len);
+        }
+        job_append(job, p, end - p);
+        job_append(job, "\n", 1);
+
+        spill_open();
+        spill_write(&(struct iovec){job->out, job->out_len}, 1);
+        UndoRecord *record = journal_push(UNDO_TEXT, k, node->weight, NULL);
+        record->text = node->text;
+        record->len = node->len;
+        record->flags = node->flags;
+        release_text(node->text, node->len);
+        node->text = spill_map(job->out_len);
+        node->len = (int)job->out_len - 1;
+        node->flags = LINE_NL;
+    }
+    return lines_changed;
+}
+
+/*
+ * `s/viejo/nuevo/`: sustituye todas las apariciones en todo el buffer.
+ * En buffers grandes repartimos las líneas en tramos, uno por hilo. Los
+ * hilos solo LEEN el árbol; al terminar, el hilo principal copia los
+ * textos nuevos a la arena y los cuelga de sus líneas.
+ */
+bool substitute(const char *old_text, const char *new_text)
+{
+    size_t old_len = strlen(old_text);
+    if (old_len == 0)
+        return report_error("Error: patrón vacío.");
+    if (line_count == 0) {
+        message("Patrón no encontrado.\n");
+        return true;
+    }
+
+    int threads = 1;
+    if (line_count >= SUBST_PARALLEL_LINES) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus < 1 ? 1 : cpus > MAX_THREADS ? MAX_THREADS : (int)cpus;
+    }
+
+    SubstJob jobs[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    int per_thread = (line_count + threads - 1) / threads;
+    for (int t = 0; t < threads; t++) {
+        jobs[t] = (SubstJob){0};
+        jobs[t].first = t * per_thread + 1;
+        jobs[t].last = jobs[t].first + per_thread - 1;
+        if (jobs[t].last > line_count)
+            jobs[t].last = line_count;
+        jobs[t].old_text = old_text;
+        jobs[t].old_len = old_len;
+        jobs[t].new_text = new_text;
+        jobs[t].new_len = strlen(new_text);
+    }
+
+    /* El hilo principal se queda con el primer tramo. */
+    for (int t = 1; t < threads; t++)
+        if (jobs[t].first <= jobs[t].last)
+            pthread_create(&tids[t], NULL, subst_worker, &jobs[t]);
+    subst_worker(&jobs[0]);
+
+    long replacements = 0, lines_changed = 0;
+    for (int t = 0; t < threads; t++) {
+        SubstJob *job = &jobs[t];
+        if (t > 0 && job->first <= job->last)
+            pthread_join(tids[t], NULL);
+        for (int h = 0; h < job->hit_count; h++) {
+            SubstHit *hit = &job->hits[h];
+            size_t end = h + 1 < job->hit_count ? job->hits[h + 1].offset
+                                                : job->out_len;
+            Line *line = hit->line;
+            UndoRecord *record = journal_push(UNDO_TEXT, hit->number, 1, NULL);
+            record->text = line->text;
+            record->len = line->len;
+            record->flags = line->flags;
+            line->len = (int)(end - hit->offset);
+            line->text = add_text(job->out + hit->offset, line->len);
+            line->flags = LINE_OWNED | LINE_NL;
+        }
+        replacements += job->replacements;
+        lines_changed += job->hit_count;
+        free(job->hits);
+        free(job->out);
+    }
+    if (page_limit) {
+        SubstJob blocks = jobs[0];
+        blocks.out = NULL;
+        blocks.out_len = blocks.out_capacity = 0;
+        blocks.replacements = 0;
+        lines_changed += substitute_blocks(&blocks);
+        replacements += blocks.replacements;
+        free(blocks.out);
+    }
+
+    if (lines_changed == 0) {
+        message("Patrón no encontrado.\n");
+        return true;
+    }
+    message("%ld sustituciones en %ld líneas.\n", replacements, lines_changed);
+    modified = true;
+    return true;
+}
+
+/* --- Ordenar y eliminar repetidos --- */
+
+/*
+ * Clave de ordenación de una línea. `prefix` guarda sus primeros 8 bytes
+ * como un número (el primer byte en la parte alta), así que comparar dos
+ * prefijos es comparar dos enteros y casi nunca hay que ir al texto.
+ * La clave lleva también el puntero al texto: comparar no salta al nodo,
+ * y sirve igual para las líneas de dentro de un bloque (modo paginado).
+ */
+typedef struct {
+    uint64_t prefix;
+    const char *text;
+    int len;
+    unsigned flags;    /* LINE_OWNED y LINE_NL de la línea */
+} SortKey;
+
+SortKey make_key(const char *text, int len, unsigned flags)
+{
+    SortKey key = {0, text, len, flags};
+    for (int i = 0; i < 8; i++)
+        key.prefix = key.prefix << 8 | (i < len ? (unsigned char)text[i] : 0);
+    return key;
+}
+
+/* Orden por bytes, como `sort` con LC_ALL=C. */
+int compare_keys(const SortKey *a, const SortKey *b)
+{
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+    int n = a->len < b->len ? a->len : b->len;
+    if (n > 8) {
+        int r = memcmp(a->text + 8, b->text + 8, n - 8);
+        if (r != 0)
+            return r;
+    }
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+/* Banderas de la línea actual: dentro de un bloque siempre sigue '\n'. */
+unsigned iter_flags(const LineIter *it)
+{
+    unsigned flags = it->node->flags & (LINE_OWNED | LINE_NL);
+    return it->left > 0 ? flags | LINE_NL : flags;
+}
+
+/* Lee `n` claves a partir de la línea actual de `it` (incluida). */
+void read_keys(LineIter *it, SortKey *keys, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0)
+            iter_next(it);
+        keys[i] = make_key(it->text, it->len, iter_flags(it));
+    }
+}
+
+/* Mezcla dos tramos ordenados en `out`. A igualdad gana `a`: es estable. */
+void merge_keys(const SortKey *a, size_t na, const SortKey *b, size_t nb,
+                SortKey *out)
+{
+    size_t i = 0, j = 0;
+    while (i < na && j < nb)
+        *out++ = compare_keys(&b[j], &a[i]) < 0 ? b[j++] : a[i++];
+    memcpy(out, a + i, (na - i) * sizeof(SortKey));
+    memcpy(out + (na - i), b + j, (nb - j) * sizeof(SortKey));
+}
+
+/*
+ * Ordenación por mezcla de abajo arriba: tramos de SORT_RUN claves por
+ * inserción y después mezclas de tramos cada vez el doble de largos,
+ * alternando entre `keys` y `tmp`. El resultado queda en `keys`.
+ */
+void sort_keys(SortKey *keys, SortKey *tmp, size_t n)
+{
+    for (size_t start = 0; start < n; start += SORT_RUN) {
+        size_t end = start + SORT_RUN < n ? start + SORT_RUN : n;
+        for (size_t i = start + 1; i < end; i++) {
+            SortKey key = keys[i];
+            size_t j = i;
+            for (; j > start && compare_keys(&key, &keys[j - 1]) < 0; j--)
+                keys[j] = keys[j - 1];
+            keys[j] = key;
+        }
+    }
+
+    SortKey *src = keys, *dst = tmp;
+    for (size_t width = SORT_RUN; width < n; width *= 2) {
+        for (size_t start = 0; start < n; start += 2 * width) {
+            size_t mid = start + width < n ? start + width : n;
+            size_t end = start + 2 * width < n ? start + 2 * width : n;
+            merge_keys(src + start, mid - start, src + mid, end - mid,
+                       dst + start);
+        }
+        SortKey *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != keys)
+        memcpy(keys, src, n * sizeof(SortKey));
+}
+
+/*
+ * Trabajo de ordenación para un hilo: en la primera ronda ordena su
+ * trozo `first`..`last`; en las siguientes mezcla dos trozos vecinos
+ * (`first`..`mid` y `mid`..`last`) de `src` en `dst`.
+ */
+typedef struct {
+    SortKey *src, *dst;
+    size_t first, mid, last;
+} SortJob;
+
+void *sort_worker(void *arg)
+{
+    SortJob *job = arg;
+    sort_keys(job->src + job->first, job->dst + job->first,
+              job->last - job->first);
+    return NULL;
+}
+
+void *merge_worker(void *arg)
+{
+    SortJob *job = arg;
+    merge_keys(job->src + job->first, job->mid - job->first,
+               job->src + job->mid, job->last - job->mid,
+               job->dst + job->first);
+    return NULL;
+}
+
+/* Ejecuta `count` trabajos a la vez; el hilo principal hace el primero. */
+void run_sort_jobs(void *(*worker)(void *), SortJob *jobs, int count)
+{
+    pthread_t tids[MAX_THREADS];
+    for (int t = 1; t < count; t++)
+        pthread_create(&tids[t], NULL, worker, &jobs[t]);
+    worker(&jobs[0]);
+    for (int t = 1; t < count; t++)
+        pthread_join(tids[t], NULL);
+}
+
+/*
+ * Ordena `n` claves (`tmp` debe tener el mismo tamaño). En rangos
+ * grandes cada hilo ordena un trozo y luego se mezclan por parejas,
+ * también en paralelo, hasta que queda un único tramo.
+ */
+void parallel_sort(SortKey *keys, SortKey *tmp, size_t n)
+{
+    int threads = 1;
+    if (n >= SORT_PARALLEL_LINES) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        while (threads * 2 <= cpus && threads * 2 <= MAX_THREADS)
+            threads *= 2; /* Potencia de dos: las parejas siempre cuadran */
+    }
+
+    SortJob jobs[MAX_THREADS];
+    size_t bounds[MAX_THREADS + 1];
+    for (int t = 0; t <= threads; t++)
+        bounds[t] = n * t / threads;
+    for (int t = 0; t < threads; t++)
+        jobs[t] = (SortJob){keys, tmp, bounds[t], bounds[t], bounds[t + 1]};
+    run_sort_jobs(sort_worker, jobs, threads);
+
+    SortKey *src = keys, *dst = tmp;
+    for (int step = 1; step < threads; step *= 2) {
+        int count = 0;
+        for (int t = 0; t < threads; t += 2 * step)
+            jobs[count++] = (SortJob){src, dst, bounds[t], bounds[t + step],
+                                      bounds[t + 2 * step]};
+        run_sort_jobs(merge_worker, jobs, count);
+        SortKey *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != keys)
+        memcpy(keys, src, n * sizeof(SortKey));
+}
+
+/*
+ * Destino de las líneas que producen `sort` y `uniq`. En modo normal
+ * cada línea es un nodo NUEVO que comparte el texto con la original; en
+ * modo paginado el texto se vuelca al spill (juntando las piezas
+ * contiguas) y después se reparte en bloques.
+ */
+typedef struct {
+    TreapBuilder builder;
+    struct iovec iov[SAVE_IOVECS];
+    int iov_count;
+    size_t size;           /* Bytes enviados al spill */
+    int lines;
+} LineSink;
+
+void sink_push(LineSink *sink, const char *text, int len, unsigned flags)
+{
+    if (!page_limit) {
+        Line *line = create_line_ref(text, len);
+        line->flags = flags;
+        builder_push(&sink->builder, line);
+        sink->lines++;
+        return;
+    }
+
+    if (sink->lines++ == 0)
+        spill_open();
+    if (sink->iov_count + 2 > SAVE_IOVECS) {
+        spill_write(sink->iov, sink->iov_count);
+        sink->iov_count = 0;
+    }
+    struct iovec *last = sink->iov_count > 0 ? &sink->iov[sink->iov_count - 1]
+                                             : NULL;
+    if (last && (const char *)last->iov_base + last->iov_len == text) {
+        last->iov_len += len;
+    } else {
+        sink->iov[sink->iov_count].iov_base = (char *)text;
+        sink->iov[sink->iov_count++].iov_len = len;
+    }
+    if (flags & LINE_NL) {
+        sink->iov[sink->iov_count - 1].iov_len++; /* '\n' ya en memoria */
+    } else {
+        sink->iov[sink->iov_count].iov_base = "\n";
+        sink->iov[sink->iov_count++].iov_len = 1;
+    }
+    sink->size += len + 1;
+}
+
+/* Modo paginado: termina de volcar y devuelve el texto ya proyectado. */
+const char *sink_text(LineSink *sink)
+{
+    if (sink->iov_count > 0)
+        spill_write(sink->iov, sink->iov_count);
+    sink->iov_count = 0;
+    return spill_map(sink->size);
+}
+
+/* Devuelve el árbol con todas las líneas recibidas. */
+Line *sink_finish(LineSink *sink)
+{
+    if (!page_limit)
+        return builder_finish(&sink->builder);
+    int lines = 0;
+    return build_blocks(sink_text(sink), sink->size, &lines);
+}
+
+/*
+ * Sustituye las líneas `first`..`last` por `tree` (`count` líneas). Las
+ * originales pasan intactas al historial: deshacer es engancharlas de
+ * nuevo, sin copiar nada.
+ */
+void replace_range(int first, int last, Line *tree, int count)
+{
+    int old_count = last - first + 1;
+    journal_push(UNDO_DELETE, first, old_count,
+                 detach_lines(first, old_count));
+    attach_lines(tree, first - 1);
+    journal_push(UNDO_INSERT, first, count, NULL);
+    modified = true;
+}
+
+/*
+ * Un tramo ordenado ("run") de la ordenación externa: su texto en el
+ * spill y la línea por la que va la mezcla.
+ */
+typedef struct {
+    const char *next, *end;  /* Lo que queda por mezclar */
+    const char *released;    /* Hasta aquí ya se soltaron las páginas */
+    SortKey key;             /* Línea actual */
+} SortRun;
+
+/* Pasa a la siguiente línea del tramo; false si se acabó. */
+bool run_advance(SortRun *run)
+{
+    if (run->next - run->released >= PAGE_BLOCK_BYTES) {
+        release_text(run->released, run->next - run->released);
+        run->released = run->next;
+    }
+    if (run->next == run->end)
+        return false;
+    const char *nl = memchr(run->next, '\n', run->end - run->next);
+    run->key = make_key(run->next, (int)(nl - run->next), LINE_NL);
+    run->next = nl + 1;
+    return true;
+}
+
+/* ¿Va la línea actual del tramo `a` antes que la de `b`? */
+bool run_less(const SortRun *runs, int a, int b)
+{
+    int order = compare_keys(&runs[a].key, &runs[b].key);
+    return order < 0 || (order == 0 && a < b); /* Estable */
+}
+
+/* Hunde el elemento `i` del montículo de tramos hasta su sitio. */
+void heap_sift(int *heap, int count, int i, const SortRun *runs)
+{
+    while (true) {
+        int least = i;
+        int left = 2 * i + 1, right = left + 1;
+        if (left < count && run_less(runs, heap[left], heap[least]))
+            least = left;
+        if (right < count && run_less(runs, heap[right], heap[least]))
+            least = right;
+        if (least == i)
+            return;
+        int swap = heap[i];
+        heap[i] = heap[least];
+        heap[least] = swap;
+        i = least;
+    }
+}
+
+/*
+ * Ordenación EXTERNA, para rangos cuyas claves no caben en `page_limit`:
+ * se ordenan trozos de `chunk` líneas en memoria, cada trozo ordenado se
+ * vuelca al spill, y al final se mezclan todos a la vez (mezcla de k
+ * vías con un montículo), enviando el resultado a `sink`.
+ */
+void external_sort(int first, size_t n, size_t chunk, LineSink *sink)
+{
+    int run_count = (int)((n + chunk - 1) / chunk);
+    SortKey *keys = malloc(chunk * sizeof(SortKey));
+    SortKey *tmp = malloc(chunk * sizeof(SortKey));
+    SortRun *runs = malloc(run_count * sizeof(SortRun));
+    int *heap = malloc(run_count * sizeof(int));
+    if (!keys || !tmp || !runs || !heap) {
+        perror("malloc falló al ordenar");
+        exit(1);
+    }
+
+    LineIter it;
+    iter_seek(&it, first);
+    for (int r = 0; r < run_count; r++) {
+        size_t count = r + 1 < run_count ? chunk : n - (size_t)r * chunk;
+        if (r > 0)
+            iter_next(&it);
+        read_keys(&it, keys, count);
+        parallel_sort(keys, tmp, count);
+
+        LineSink out = {0};
+        for (size_t i = 0; i < count; i++)
+            sink_push(&out, keys[i].text, keys[i].len, keys[i].flags);
+        runs[r].next = runs[r].released = sink_text(&out);
+        runs[r].end = runs[r].next + out.size;
+    }
+    free(keys);
+    free(tmp);
+
+    for (int r = 0; r < run_count; r++) {
+        run_advance(&runs[r]);
+        heap[r] = r;
+    }
+    int count = run_count;
+    for (int i = count / 2 - 1; i >= 0; i--)
+        heap_sift(heap, count, i, runs);
+    while (count > 0) {
+        SortRun *run = &runs[heap[0]];
+        sink_push(sink, run->key.text, run->key.len, LINE_NL);
+        if (!run_advance(run))
+            heap[0] = heap[--count];
+        heap_sift(heap, count, 0, runs);
+    }
+    free(runs);
+    free(heap);
+}
+
+/* ¿Están ya en orden las líneas `first`..`last`? Una pasada, sin memoria. */
+bool range_sorted(int first, int last)
+{
+    LineIter it;
+    iter_seek(&it, first);
+    SortKey prev = make_key(it.text, it.len, 0);
+    while (it.number < last && iter_next(&it)) {
+        SortKey key = make_key(it.text, it.len, 0);
+        if (compare_keys(&prev, &key) > 0)
+            return false;
+        prev = key;
+    }
+    return true;
+}
+
+/*
+ * `sort [a,b]`: ordena las líneas por bytes. Si las claves caben en
+ * memoria, ordenación por mezcla en paralelo; si no, ordenación externa.
+ * Las líneas ordenadas son nodos (o bloques) nuevos y las originales
+ * van al historial.
+ */
+bool sort_range(int first, int last)
+{
+    if (first < 1 || last > line_count || first > last)
+        return report_error("Error: rango inválido.");
+
+    if (range_sorted(first, last)) {
+        message("Las líneas ya estaban ordenadas.\n");
+        return true;
+    }
+
+    size_t n = (size_t)(last - first + 1);
+    /* En modo paginado, claves + espacio auxiliar dentro del tope. */
+    size_t chunk = page_limit ? page_limit / (2 * sizeof(SortKey)) : n;
+    if (chunk < 2)
+        chunk = 2;
+
+    LineSink sink = {0};
+    if (n > chunk) {
+        external_sort(first, n, chunk, &sink);
+    } else {
+        SortKey *keys = malloc(n * sizeof(SortKey));
+        SortKey *tmp = malloc(n * sizeof(SortKey));
+        if (!keys || !tmp) {
+            perror("malloc falló al ordenar");
+            exit(1);
+        }
+        LineIter it;
+        iter_seek(&it, first);
+        read_keys(&it, keys, n);
+        parallel_sort(keys, tmp, n);
+        for (size_t i = 0; i < n; i++)
+            sink_push(&sink, keys[i].text, keys[i].len, keys[i].flags);
+        free(keys);
+        free(tmp);
+    }
+
+    Line *tree = sink_finish(&sink);
+    replace_range(first, last, tree, sink.lines);
+    return true;
+}
+
+/*
+ * Hash de 64 bits de un texto, 8 bytes por paso (multiplicar y mezclar
+ * los bits altos con los bajos).
+ */
+uint64_t hash_text(const char *text, size_t len)
+{
+    uint64_t h = 0x9e3779b97f4a7c15u ^ len;
+    uint64_t word;
+    for (; len >= 8; text += 8, len -= 8) {
+        memcpy(&word, text, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdu;
+        h ^= h >> 32;
+    }
+    word = 0;
+    memcpy(&word, text, len);
+    h = (h ^ word) * 0xff51afd7ed558ccdu;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53u;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * Conjunto de líneas ya vistas: tabla hash de direccionamiento abierto
+ * (sondeo lineal) con capacidad potencia de dos. Cada hueco guarda el
+ * texto y 32 bits del hash, que además dan su posición en la tabla.
+ */
+typedef struct {
+    const char *text;    /* NULL: hueco libre */
+    int len;
+    uint32_t hash;
+} SeenLine;
+
+typedef struct {
+    SeenLine *slots;
+    size_t mask;         /* Capacidad - 1 */
+    size_t count;
+} SeenSet;
+
+/* Reserva una tabla vacía de `capacity` huecos (potencia de dos). */
+void seen_init(SeenSet *set, size_t capacity)
+{
+    set->slots = calloc(capacity, sizeof(SeenLine));
+    if (!set->slots) {
+        perror("calloc falló para la tabla de líneas");
+        exit(1);
+    }
+    set->mask = capacity - 1;
+    set->count = 0;
+}
+
+/* Duplica la capacidad y recoloca las entradas (sin recalcular hashes). */
+void seen_grow(SeenSet *set)
+{
+    SeenSet bigger;
+    seen_init(&bigger, 2 * (set->mask + 1));
+    for (size_t i = 0; i <= set->mask; i++) {
+        SeenLine *slot = &set->slots[i];
+        if (!slot->text)
+            continue;
+        size_t j = slot->hash & bigger.mask;
+        while (bigger.slots[j].text)
+            j = (j + 1) & bigger.mask;
+        bigger.slots[j] = *slot;
+    }
+    bigger.count = set->count;
+    free(set->slots);
+    *set = bigger;
+}
+
+/* Añade una línea al conjunto; devuelve false si ya estaba. */
+bool seen_insert(SeenSet *set, uint32_t hash, const char *text, int len)
+{
+    if (4 * (set->count + 1) > 3 * (set->mask + 1))
+        seen_grow(set);
+    size_t i = hash & set->mask;
+    for (; set->slots[i].text; i = (i + 1) & set->mask) {
+        SeenLine *slot = &set->slots[i];
+        if (slot->hash == hash && slot->len == len &&
+            memcmp(slot->text, text, len) == 0)
+            return false;
+    }
+    set->slots[i] = (SeenLine){text, len, hash};
+    set->count++;
+    return true;
+}
+
+/*
+ * `uniq [a,b]`: deja solo la primera aparición de cada línea, sin
+ * cambiar el orden. Las líneas vistas van a una tabla hash; si en el
+ * peor caso (todas distintas) no cupiera en `page_limit`, se reparten
+ * por su hash en varias pasadas y cada una guarda solo su parte. Un
+ * mapa de bits recuerda qué líneas se quedan.
+ */
+bool uniq_range(int first, int last)
+{
+    if (first < 1 || last > line_count || first > last)
+        return report_error("Error: rango inválido.");
+
+    size_t n = (size_t)(last - first + 1);
+    size_t parts = 1;
+    while (page_limit && n / parts * 2 * sizeof(SeenLine) > page_limit &&
+           parts < n)
+        parts *= 2;
+    unsigned char *keep = calloc((n + 7) / 8, 1);
+    if (!keep) {
+        perror("calloc falló en uniq");
+        exit(1);
+    }
+
+    size_t kept = 0;
+    LineIter it;
+    for (size_t part = 0; part < parts; part++) {
+        SeenSet seen;
+        seen_init(&seen, 1024);
+        iter_seek(&it, first);
+        for (size_t i = 0; i < n; i++) {
+            if (i > 0)
+                iter_next(&it);
+            uint64_t h = hash_text(it.text, it.len);
+            if (((h >> 32) & (parts - 1)) != part)
+                continue;
+            if (seen_insert(&seen, (uint32_t)h, it.text, it.len)) {
+                keep[i / 8] |= 1 << (i % 8);
+                kept++;
+            }
+        }
+        free(seen.slots);
+    }
+    if (kept == n) {
+        free(keep);
+        message("No hay líneas repetidas.\n");
+        return true;
+    }
+
+    LineSink sink = {0};
+    iter_seek(&it, first);
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0)
+            iter_next(&it);
+        if (keep[i / 8] & (1 << (i % 8)))
+            sink_push(&sink, it.text, it.len, iter_flags(&it));
+    }
+    free(keep);
+
+    Line *tree = sink_finish(&sink);
+    replace_range(first, last, tree, sink.lines);
+    message("%zu líneas repetidas eliminadas.\n", n - kept);
+    return true;
+}
+
+/* --- Diferencias con el archivo en disco --- */
+
+#define DIFF_CONTEXT 3       /* Líneas de contexto alrededor de cada cambio */
+#define DIFF_ANCHOR_LINES 256 /* Cajas mayores: anclas si Myers se alarga */
+#define DIFF_ANCHOR_DEPTH 32  /* Niveles de anclas como mucho */
+#define DIFF_QUICK_STEPS 64   /* Pasos de Myers antes de recurrir a anclas */
+#define HASH_CACHE_MIN_LEN 1024 /* Líneas más cortas: se hashean al vuelo */
+
+/*
+ * Caché de los hashes de las líneas del buffer. No va en el nodo: serían
+ * 8 bytes más en cada línea aunque nunca se use `diff`. Va en una tabla
+ * aparte cuya clave es el puntero al texto (y su longitud), que nunca
+ * se modifica en su sitio: editar una línea le da un texto nuevo, así
+ * que una entrada no se queda anticuada; solo hay que vaciar la tabla
+ * cuando se libera el texto (`free_buffer`). Solo guarda líneas largas:
+ * hashear una corta cuesta menos que el fallo de caché de buscarla.
+ */
+typedef struct {
+    const char *text;    /* NULL: hueco libre */
+    int len;
+    uint64_t hash;
+} HashSlot;
+
+HashSlot *hash_cache = NULL;
+size_t hash_cache_mask = 0;  /* Capacidad - 1 (0: sin tabla) */
+size_t hash_cache_count = 0;
+
+/* Posición inicial de un texto en la caché (hash de Fibonacci). */
+size_t hash_cache_home(const char *text, size_t mask)
+{
+    return (size_t)(((uintptr_t)text * 0x9e3779b97f4a7c15u) >> 32) & mask;
+}
+
+/* Duplica la caché (o la crea) y recoloca las entradas. */
+void hash_cache_grow(void)
+{
+    size_t capacity = hash_cache_mask ? 2 * (hash_cache_mask + 1) : 1024;
+    HashSlot *slots = calloc(capacity, sizeof(HashSlot));
+    if (!slots) {
+        perror("calloc falló para la caché de hashes");
+        exit(1);
+    }
+    for (size_t i = 0; hash_cache && i <= hash_cache_mask; i++) {
+        if (!hash_cache[i].text)
+            continue;
+        size_t j = hash_cache_home(hash_cache[i].text, capacity - 1);
+        while (slots[j].text)
+            j = (j + 1) & (capacity - 1);
+        slots[j] = hash_cache[i];
+    }
+    free(hash_cache);
+    hash_cache = slots;
+    hash_cache_mask = capacity - 1;
+}
+
+/* Vacía la caché: hace falta antes de liberar o reutilizar el texto. */
+void hash_cache_clear(void)
+{
+    free(hash_cache);
+    hash_cache = NULL;
+    hash_cache_mask = 0;
+    hash_cache_count = 0;
+}
+
+/*
+ * Hash de una línea del buffer para `diff`. El `| 1` reserva el 0 para
+ * los huecos libres de `DiffSlot`; el archivo en disco usa el mismo
+ * criterio.
+ */
+uint64_t line_hash(const char *text, int len)
+{
+    if (len < HASH_CACHE_MIN_LEN)
+        return hash_text(text, len) | 1;
+
+    size_t i = hash_cache_mask ? hash_cache_home(text, hash_cache_mask) : 0;
+    for (; hash_cache && hash_cache[i].text; i = (i + 1) & hash_cache_mask)
+        if (hash_cache[i].text == text && hash_cache[i].len == len)
+            return hash_cache[i].hash;
+
+    uint64_t hash = hash_text(text, len) | 1;
+    if (4 * (hash_cache_count + 1) > 3 * (hash_cache_mask + 1)) {
+        hash_cache_grow();
+        i = hash_cache_home(text, hash_cache_mask);
+        while (hash_cache[i].text)
+            i = (i + 1) & hash_cache_mask;
+    }
+    hash_cache[i] = (HashSlot){text, len, hash};
+    hash_cache_count++;
+    return hash;
+}
+
+/*
+ * Estado de una comparación. Las dos secuencias son los hashes de las
+ * líneas: el archivo en disco ("old", a la izquierda en la rejilla de
+ * Myers) y el buffer ("new", arriba). Al final, `*_changed` marca las
+ * líneas borradas de "old" y las añadidas en "new".
+ */
+typedef struct {
+    const uint64_t *old_hash, *new_hash;
+    unsigned char *old_changed, *new_changed;
+    int *vf, *vb;    /* Vectores V de Myers, hacia delante y hacia atrás */
+} DiffContext;
+
+/* Tramo de la solución: una edición y una diagonal de líneas iguales. */
+typedef struct {
+    int x0, y0, x1, y1;
+    bool forward;    /* La edición va al principio (true) o al final */
+} Snake;
+
+/*
+ * Serpiente central de la caja (left,top)-(right,bottom) del algoritmo de
+ * Myers en espacio lineal: se avanza a la vez desde la esquina de inicio
+ * y desde la de fin, `d` ediciones cada vez, hasta que los dos caminos se
+ * tocan. La serpiente en la que se tocan pertenece a un camino mínimo.
+ * Devuelve false si no la encuentra en `limit` pasos.
+ */
+bool middle_snake(DiffContext *ctx, int left, int top, int right, int bottom,
+                  int limit, Snake *snake)
+{
+    const uint64_t *a = ctx->old_hash, *b = ctx->new_hash;
+    int width = right - left, height = bottom - top;
+    int max = (width + height + 1) / 2;
+    int delta = width - height;
+    bool odd = delta % 2 != 0;
+    int *vf = ctx->vf + max + 1; /* Índices de -max-1 a max+1 */
+    int *vb = ctx->vb + max + 1;
+    vf[1] = left;
+    vb[1] = bottom;
+
+    for (int d = 0; d <= max && d <= limit; d++) {
+        /* Hacia delante: `vf[k]` es la x más lejana en la diagonal k. */
+        for (int k = d; k >= -d; k -= 2) {
+            int x, px;
+            if (k == -d || (k != d && vf[k - 1] < vf[k + 1])) {
+                px = x = vf[k + 1];  /* Bajar: línea añadida */
+            } else {
+                px = vf[k - 1];      /* A la derecha: línea borrada */
+                x = px + 1;
+            }
+            int y = top + (x - left) - k;
+            int py = (d == 0 || x != px) ? y : y - 1;
+            while (x < right && y < bottom && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            vf[k] = x;
+            int c = k - delta;
+            if (odd && c >= -(d - 1) && c <= d - 1 && y >= vb[c]) {
+                *snake = (Snake){px, py, x, y, true};
+                return true;
+            }
+        }
+        /* Hacia atrás: `vb[c]` es la y más alta en la diagonal c. */
+        for (int c = d; c >= -d; c -= 2) {
+            int y, py;
+            if (c == -d || (c != d && vb[c + 1] < vb[c - 1])) {
+                py = y = vb[c + 1];  /* A la izquierda: línea borrada */
+            } else {
+                py = vb[c - 1];      /* Subir: línea añadida */
+                y = py - 1;
+            }
+            int k = c + delta;
+            int x = left + (y - top) + k;
+            int px = (d == 0 || y != py) ? x : x + 1;
+            while (x > left && y > top && a[x - 1] == b[y - 1]) {
+                x--;
+                y--;
+            }
+            vb[c] = y;
+            if (!odd && k >= -d && k <= d && x <= vf[k]) {
+                *snake = (Snake){x, y, px, py, false};
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void diff_box(DiffContext *ctx, int left, int top, int right, int bottom,
+              int depth);
+
+/*
+ * Dónde aparece un hash en cada secuencia (para buscar anclas): 0 si no
+ * aparece, posición + 1 si aparece una vez, -1 si aparece varias.
+ */
+typedef struct {
+    uint64_t hash;           /* 0: hueco libre */
+    int old_pos, new_pos;
+} DiffSlot;
+
+DiffSlot *diff_slot(DiffSlot *slots, size_t mask, uint64_t hash)
+{
+    size_t i = hash & mask;
+    while (slots[i].hash && slots[i].hash != hash)
+        i = (i + 1) & mask;
+    slots[i].hash = hash;
+    return &slots[i];
+}
+
+/*
+ * Anclas (como en "patience diff"): las líneas que aparecen UNA sola vez
+ * en cada lado de la caja casi seguro que se corresponden. De esas
+ * parejas nos quedamos con la subsecuencia creciente más larga (las que
+ * no se cruzan) y solo comparamos con Myers los huecos entre anclas, que
+ * suelen ser diminutos. Devuelve false si no hay ninguna ancla.
+ */
+bool diff_anchors(DiffContext *ctx, int left, int top, int right, int bottom,
+                  int depth)
+{
+    const uint64_t *a = ctx->old_hash, *b = ctx->new_hash;
+    size_t capacity = 16;
+    while (capacity < (size_t)(right - left + bottom - top) * 4 / 3)
+        capacity *= 2;
+    DiffSlot *slots = calloc(capacity, sizeof(DiffSlot));
+    int *pairs = malloc((right - left) * 2 * sizeof(int));
+    if (!slots || !pairs) {
+        perror("malloc falló en diff");
+        exit(1);
+    }
+    for (int x = left; x < right; x++) {
+        DiffSlot *slot = diff_slot(slots, capacity - 1, a[x]);
+        slot->old_pos = slot->old_pos == 0 ? x + 1 : -1;
+    }
+    for (int y = top; y < bottom; y++) {
+        DiffSlot *slot = diff_slot(slots, capacity - 1, b[y]);
+        slot->new_pos = slot->new_pos == 0 ? y + 1 : -1;
+    }
+    int count = 0;
+    for (int x = left; x < right; x++) {
+        DiffSlot *slot = diff_slot(slots, capacity - 1, a[x]);
+        if (slot->old_pos > 0 && slot->new_pos > 0) {
+            pairs[2 * count] = x;
+            pairs[2 * count + 1] = slot->new_pos - 1;
+            count++;
+        }
+    }
+    free(slots);
+    if (count == 0) {
+        free(pairs);
+        return false;
+    }
+
+    /*
+     * Subsecuencia creciente más larga de las `y` (las `x` ya van en
+     * orden), por "ordenación de paciencia": `tails[l]` es la pareja con
+     * la menor `y` que termina una subsecuencia de longitud l + 1.
+     */
+    int *tails = malloc(count * sizeof(int));
+    int *prev = malloc(count * sizeof(int));
+    if (!tails || !prev) {
+        perror("malloc falló en diff");
+        exit(1);
+    }
+    int length = 0;
+    for (int i = 0; i < count; i++) {
+        int lo = 0, hi = length;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (pairs[2 * tails[mid] + 1] < pairs[2 * i + 1])
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        prev[i] = lo > 0 ? tails[lo - 1] : -1;
+        tails[lo] = i;
+        if (lo == length)
+            length++;
+    }
+    /* Reconstruir la cadena al revés, reutilizando `tails`. */
+    for (int i = tails[length - 1], l = length - 1; i != -1; i = prev[i])
+        tails[l--] = i;
+    free(prev);
+
+    int x = left, y = top;
+    for (int l = 0; l < length; l++) {
+        int ax = pairs[2 * tails[l]], ay = pairs[2 * tails[l] + 1];
+        diff_box(ctx, x, y, ax, ay, depth + 1);
+        x = ax + 1;
+        y = ay + 1;
+    }
+    diff_box(ctx, x, y, right, bottom, depth + 1);
+    free(tails);
+    free(pairs);
+    return true;
+}
+
+/*
+ * Compara `old[left..right)` con `new[top..bottom)`: quita lo común al
+ * principio y al final, busca la serpiente central y resuelve por
+ * separado lo que queda antes y después de ella. Si la caja es grande y
+ * la serpiente no aparece pronto (muchos cambios), se parte antes en
+ * anclas. `depth` limita los niveles de anclas.
+ */
+void diff_box(DiffContext *ctx, int left, int top, int right, int bottom,
+              int depth)
+{
+    const uint64_t *a = ctx->old_hash, *b = ctx->new_hash;
+    while (left < right && top < bottom && a[left] == b[top]) {
+        left++;
+        top++;
+    }
+    while (left < right && top < bottom && a[right - 1] == b[bottom - 1]) {
+        right--;
+        bottom--;
+    }
+    if (left == right) {
+        memset(ctx->new_changed + top, 1, bottom - top);
+        return;
+    }
+    if (top == bottom) {
+        memset(ctx->old_changed + left, 1, right - left);
+        return;
+    }
+
+    Snake s;
+    bool large = right - left + bottom - top > DIFF_ANCHOR_LINES &&
+                 depth < DIFF_ANCHOR_DEPTH;
+    if (!middle_snake(ctx, left, top, right, bottom,
+                      large ? DIFF_QUICK_STEPS : INT_MAX, &s)) {
+        if (diff_anchors(ctx, left, top, right, bottom, depth))
+            return;
+        middle_snake(ctx, left, top, right, bottom, INT_MAX, &s);
+    }
+    diff_box(ctx, left, top, s.x0, s.y0, depth);
+    int dx = s.x1 - s.x0, dy = s.y1 - s.y0;
+    if (dx > dy)
+        ctx->old_changed[s.forward ? s.x0 : s.x1 - 1] = 1;
+    else if (dy > dx)
+        ctx->new_changed[s.forward ? s.y0 : s.y1 - 1] = 1;
+    diff_box(ctx, s.x1, s.y1, right, bottom, depth);
+}
+
+/*
+ * Lee los hashes del archivo en disco. `*starts` recibe el desplazamiento
+ * de cada línea (con uno más al final, como centinela). Un archivo que
+ * no existe cuenta como vacío.
+ */
+bool hash_disk_file(const char *filename, char **base, size_t *size,
+                    uint64_t **hashes, size_t **starts, int *lines)
+{
+    *base = NULL;
+    *size = 0;
+    *lines = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd != -1) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            return report_error("Error: no se pudo leer '%s'.", filename);
+        }
+        *size = st.st_size;
+        if (*size > 0) {
+            *base = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (*base == MAP_FAILED) {
+                close(fd);
+                *base = NULL;
+                return report_error("Error: no se pudo proyectar '%s'.",
+                                    filename);
+            }
+        }
+        close(fd);
+    }
+
+    bool final_nl = *size == 0 || (*base)[*size - 1] == '\n';
+    long count = *size ? count_newlines(*base, *size) + !final_nl : 0;
+    if (count > INT_MAX) {
+        munmap(*base, *size);
+        return report_error("Error: '%s' tiene demasiadas líneas.", filename);
+    }
+    *lines = (int)count;
+    *hashes = malloc((count + 1) * sizeof(uint64_t));
+    *starts = malloc((count + 1) * sizeof(size_t));
+    if (!*hashes || !*starts) {
+        perror("malloc falló en diff");
+        exit(1);
+    }
+
+    size_t offset = 0;
+    for (long k = 0; k < count; k++) {
+        const char *p = *base + offset;
+        const char *nl = memchr(p, '\n', *size - offset);
+        size_t len = nl ? (size_t)(nl - p) : *size - offset;
+        (*hashes)[k] = hash_text(p, len) | 1; /* Igual que `line_hash` */
+        (*starts)[k] = offset;
+        offset += len + 1;
+    }
+    (*starts)[count] = offset;
+    return true;
+}
+
+/* Tramo de cambios: líneas `old0..old1` sustituidas por `new0..new1`. */
+typedef struct {
+    int old0, old1, new0, new1;
+} DiffGroup;
+
+/*
+ * Imprime un bloque ("hunk") de diff unificado con los grupos
+ * `groups[0..count)` y su contexto. Las líneas del buffer se leen con un
+ * iterador que avanza a la par.
+ */
+void print_hunk(const DiffGroup *groups, int count, const char *old_base,
+                const size_t *old_start, int old_lines)
+{
+    int old0 = groups[0].old0 - DIFF_CONTEXT;
+    if (old0 < 0)
+        old0 = 0;
+    int new0 = groups[0].new0 - (groups[0].old0 - old0);
+    int old1 = groups[count - 1].old1 + DIFF_CONTEXT;
+    if (old1 > old_lines)
+        old1 = old_lines;
+    int new1 = groups[count - 1].new1 + (old1 - groups[count - 1].old1);
+
+    /* Con 0 líneas, diff indica la línea anterior al hueco. */
+    trace_enter(PHASE_OUTPUT);
+    printf("@@ -%d,%d +%d,%d @@\n", old1 > old0 ? old0 + 1 : old0,
+           old1 - old0, new1 > new0 ? new0 + 1 : new0, new1 - new0);
+
+    LineIter it;
+    bool positioned = false;
+    int i = old0, j = new0;
+    for (int g = 0; g <= count; g++) {
+        /* Contexto hasta el grupo (o hasta el final del bloque). */
+        int stop = g < count ? groups[g].old0 : old1;
+        int added = g < count ? groups[g].new1 - groups[g].new0 : 0;
+        for (; i < stop; i++, j++)
+            printf(" %.*s\n", (int)(old_start[i + 1] - old_start[i] - 1),
+                   old_base + old_start[i]);
+        if (g == count)
+            break;
+        for (; i < groups[g].old1; i++)
+            printf("-%.*s\n", (int)(old_start[i + 1] - old_start[i] - 1),
+                   old_base + old_start[i]);
+        for (int n = 0; n < added; n++, j++) {
+            if (!positioned) {
+                iter_seek(&it, j + 1);
+                positioned = true;
+            }
+            while (it.number < j + 1)
+                iter_next(&it);
+            printf("+%.*s\n", it.len, it.text);
+        }
+    }
+    trace_leave();
+}
+
+/*
+ * `diff`: compara el buffer con el archivo en disco y muestra las
+ * diferencias en formato unificado (el de `diff -u`, que entiende
+ * `patch`). Se comparan hashes de 64 bits, no textos: los de las líneas
+ * largas del buffer se guardan en `hash_cache` y solo se calcula de
+ * nuevo el de las líneas que cambian.
+ */
+bool diff_buffer(const char *filename)
+{
+    char *old_base;
+    size_t old_size;
+    uint64_t *old_hash;
+    size_t *old_start;
+    int old_lines;
+    if (!hash_disk_file(filename, &old_base, &old_size, &old_hash,
+                        &old_start, &old_lines))
+        return false;
+
+    int new_lines = line_count;
+    uint64_t *new_hash = malloc((new_lines + 1) * sizeof(uint64_t));
+    unsigned char *old_changed = calloc(old_lines + 1, 1);
+    unsigned char *new_changed = calloc(new_lines + 1, 1);
+    size_t vsize = (size_t)old_lines + new_lines + 4;
+    int *vf = malloc(vsize * sizeof(int));
+    int *vb = malloc(vsize * sizeof(int));
+    if (!new_hash || !old_changed || !new_changed || !vf || !vb) {
+        perror("malloc falló en diff");
+        exit(1);
+    }
+    if (new_lines > 0) {
+        LineIter it;
+        iter_seek(&it, 1);
+        do
+            new_hash[it.number - 1] = line_hash(it.text, it.len);
+        while (iter_next(&it));
+    }
+
+    DiffContext ctx = {old_hash, new_hash, old_changed, new_changed, vf, vb};
+    diff_box(&ctx, 0, 0, old_lines, new_lines, 0);
+    free(vf);
+    free(vb);
+
+    /* Agrupar los cambios y juntar en un bloque los que están cerca. */
+    DiffGroup *groups = NULL;
+    int group_count = 0, group_capacity = 0;
+    int i = 0, j = 0;
+    while (i < old_lines || j < new_lines) {
+        if ((i < old_lines && old_changed[i]) ||
+            (j < new_lines && new_changed[j])) {
+            if (group_count == group_capacity) {
+                group_capacity = group_capacity ? group_capacity * 2 : 64;
+                groups = realloc(groups, group_capacity * sizeof(DiffGroup));
+                if (!groups) {
+                    perror("realloc falló en diff");
+                    exit(1);
+                }
+            }
+            DiffGroup *g = &groups[group_count++];
+            g->old0 = i;
+            g->new0 = j;
+            while (i < old_lines && old_changed[i])
+                i++;
+            while (j < new_lines && new_changed[j])
+                j++;
+            g->old1 = i;
+            g->new1 = j;
+        } else {
+            i++;
+            j++;
+        }
+    }
+
+    if (group_count == 0) {
+        message("Sin diferencias con '%s'.\n", filename);
+    } else {
+        printf("--- %s\t(en disco)\n+++ %s\t(buffer)\n", filename, filename);
+        int first = 0;
+        for (int g = 1; g <= group_count; g++) {
+            if (g == group_count ||
+                groups[g].old0 - groups[g - 1].old1 > 2 * DIFF_CONTEXT) {
+                print_hunk(groups + first, g - first, old_base, old_start,
+                           old_lines);
+                first = g;
+            }
+        }
+    }
+
+    free(groups);
+    free(old_changed);
+    free(new_changed);
+    free(old_hash);
+    free(new_hash);
+    free(old_start);
+    if (old_base)
+        munmap(old_base, old_size);
+    return true;
+}
+
+/*
+ * Lee hasta `max` números separados por comas ("3", "2,7", "1,4,9").
+ * Devuelve cuántos leyó, o -1 si el texto no tiene ese formato.
+ */
+int parse_numbers(const char *arg, int nums[], int max)
+{
+    int count = 0;
+    while (*arg == ' ')
+        arg++;
+    while (*arg && *arg != '\n') {
+        char *end;
+        long value = strtol(arg, &end, 10);
+        if (end == arg || count == max)
+            return -1;
+        nums[count++] = (int)value;
+        arg = end;
+        if (*arg == ',')
+            arg++;
+        else
+            break;
+    }
+    return count;
+}
+
+/*
+ * ====================================================================
+ *                          - FIN DE LA LECCIÓN -               
+ * ====================================================================
+ *
  * ¡Felicidades! Has creado una aplicación funcional desde cero.
  * Este proyecto pone en práctica la gestión de memoria, punteros
  * y estructuras de datos complejas, además de modularidad y E/S.
  *
  * LOGROS CLAVE:
- * - Implementación de una lista doblemente enlazada.
+ * - Implementación de un árbol equilibrado de líneas (treap).
  * - E/S de archivos robusta.
  * - Interfaz de línea de comandos simple.
  * - Gestión dinámica de memoria sin fugas.
@@ -341,9 +6084,29 @@ void delete_line(int line_number)
  *
  * CÓMO COMPILAR Y EJECUTAR:
  *
- * 1) gcc -Wall -Wextra -std=c11 -o editor 25_simple_editor_texto.c
+ * 1) gcc -Wall -Wextra -std=c11 -O2 -pthread -o editor 25_editor_texto_simple.c
  * 2) ./editor mi_texto.txt
  *
+ * MODO GUION (sin interacción, para cadenas de procesamiento):
+ *
+ *    ./editor -s ordenes.txt mi_texto.txt   # órdenes desde un archivo
+ *    printf 's/a/b/\ns\n' | ./editor - mi_texto.txt
+ *
+ * Sin indicadores ni mensajes; el programa termina con estado 1 en la
+ * primera orden que falle.
+ *
+ * ARCHIVOS ENORMES (modo paginado con tope de memoria):
+ *
+ *    ./editor -m 64 log_de_20GB.txt
+ *
+ * SEGUIR UN LOG MIENTRAS OTRO PROGRAMA LO ESCRIBE:
+ *
+ *    ./editor -w servidor.log
+ *
+ * MEDIR DÓNDE SE VA EL TIEMPO (perfil en JSON al salir):
+ *
+ *    ./editor --trace perfil.json mi_texto.txt
+ *
  * Comandos sugeridos:
  * > a Primera línea
  * > a Segunda línea
@@ -351,6 +6114,14 @@ void delete_line(int line_number)
  * > i 2 Línea en medio
  * > p
  * > d 1
+ * > s/Línea/Renglón/
+ * > g/Renglón/
+ * > sort
+ * > y 1,2
+ * > o otro.txt
+ * > x 0
+ * > b 1
+ * > stats
  * > s
  * > q
  */
@@ -0,0 +1,97 @@
+/*
+ * 17_registro_gpa.c - Medición: nota media de 10.000.000 de alumnos,
+ * con columnas y con el registro de antes.
+ *
+ * Llena una `StudentTable` con `table_append` y, con los mismos datos, un
+ * vector de la `struct Student` de la versión anterior (id, nombre de 50
+ * bytes y nota juntos: 64 bytes por alumno). Después mide `average_gpa`
+ * frente al mismo recorrido sobre el vector de structs. La columna de
+ * notas trae 8 bytes útiles por alumno de la memoria; el struct, 64.
+ *
+ * Compilar y ejecutar (desde esta carpeta):
+ *   gcc -Wall -Wextra -std=c11 -O2 -o gpa 17_registro_gpa.c
+ *   ./gpa [alumnos]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _POSIX_C_SOURCE 200809L /* Para clock_gettime con -std=c11 */
+
+/* El registro entero, con su `main` renombrado para usar el nuestro. */
+#define main registro_main
+#include "../17_registro_estudiantes.c"
+#undef main
+
+#include <time.h>
+
+#define ROUNDS 5 /* Nos quedamos con la vuelta más rápida */
+
+/* El registro de la versión anterior: un struct por alumno. */
+typedef struct {
+    int id;
+    char name[MAX_NAME_LEN];
+    double gpa;
+} Student;
+
+double now_seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* La misma cuenta que `average_gpa`, sobre el vector de structs. */
+double average_gpa_aos(const Student *students, size_t count)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++)
+        sum += students[i].gpa;
+    return count ? sum / count : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 10000000;
+    StudentTable table = {0};
+    Student *students = malloc(count * sizeof(Student));
+    if (students == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        char name[MAX_NAME_LEN];
+        snprintf(name, sizeof(name), "Alumno %zu", i);
+        double gpa = (double)(i % 41) / 10.0;
+        table_append(&table, (int)i, name, gpa);
+        students[i].id = (int)i;
+        snprintf(students[i].name, sizeof(students[i].name), "%s", name);
+        students[i].gpa = gpa;
+    }
+
+    double best_columns = 1e9, best_structs = 1e9;
+    double average_columns = 0.0, average_structs = 0.0;
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now_seconds();
+        average_columns = average_gpa(&table);
+        double middle = now_seconds();
+        average_structs = average_gpa_aos(students, count);
+        double end = now_seconds();
+        if (middle - start < best_columns)
+            best_columns = middle - start;
+        if (end - middle < best_structs)
+            best_structs = end - middle;
+    }
+
+    /* Imprimir las medias impide que el compilador se salte las cuentas. */
+    printf("%zu alumnos (struct Student: %zu bytes)\n", count,
+           sizeof(Student));
+    printf("columna gpas:   %8.2f ms  (media %.4f)\n", best_columns * 1e3,
+           average_columns);
+    printf("vector structs: %8.2f ms  (media %.4f)\n", best_structs * 1e3,
+           average_structs);
+
+    table_free(&table);
+    free(students);
+    return 0;
+}
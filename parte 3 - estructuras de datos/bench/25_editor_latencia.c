@@ -0,0 +1,92 @@
+/*
+ * 25_editor_latencia.c - Medición: latencia de edición de `sled` según el
+ * tamaño del archivo.
+ *
+ * Carga archivos de 10.000 a 10.000.000 de líneas y, en cada uno, inserta
+ * y borra líneas en posiciones al azar. Con el árbol de estadísticos de
+ * orden, el tiempo por edición debe crecer como log n: casi plano, cuando
+ * con la lista enlazada crecía en proporción a n.
+ *
+ * Compilar y ejecutar (desde esta carpeta):
+ *   gcc -Wall -Wextra -std=c11 -O2 -pthread -o latencia 25_editor_latencia.c
+ *   ./latencia [líneas máximas]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _POSIX_C_SOURCE 200809L /* Para clock_gettime y mkstemp con -std=c11 */
+
+/* El editor entero, con su `main` renombrado para usar el nuestro. */
+#define main sled_main
+#include "../25_editor_texto_simple.c"
+#undef main
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h> /* close, unlink */
+
+#define EDITS 200000 /* Ediciones (mitad inserciones) por tamaño */
+
+/* Reloj monótono en nanosegundos. */
+uint64_t bench_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+/* Escribe en `path` un archivo de `lines` líneas de unos 20 bytes. */
+void write_lines(const char *path, long lines)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    for (long i = 1; i <= lines; i++)
+        fprintf(file, "linea de prueba %ld\n", i);
+    fclose(file);
+}
+
+int main(int argc, char *argv[])
+{
+    long max_lines = argc > 1 ? atol(argv[1]) : 10000000;
+    char path[] = "/tmp/sled_latencia_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    srand(1);
+
+    /* "líneas" ocupa un byte más de lo que se ve (la í son dos) */
+    printf("%13s %14s %14s\n", "líneas", "insertar (ns)", "borrar (ns)");
+    for (long lines = 10000; lines <= max_lines; lines *= 10) {
+        write_lines(path, lines);
+        load_file(path);
+
+        /*
+         * Cada inserción va seguida de un borrado en otra posición al
+         * azar: el archivo no cambia de tamaño y el cursor no ayuda.
+         */
+        uint64_t insert_ns = 0, delete_ns = 0;
+        for (int i = 0; i < EDITS / 2; i++) {
+            int at = 1 + rand() % line_count;
+            uint64_t start = bench_ns();
+            insert_line(at, "nueva");
+            uint64_t middle = bench_ns();
+            delete_line(1 + rand() % line_count);
+            uint64_t end = bench_ns();
+            insert_ns += middle - start;
+            delete_ns += end - middle;
+        }
+        printf("%12ld %14.0f %14.0f\n", lines,
+               (double)insert_ns / (EDITS / 2),
+               (double)delete_ns / (EDITS / 2));
+        fflush(stdout);
+        free_buffer();
+    }
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,127 @@
+/*
+ * 25_editor_patrones.c - Medición: el cursor de `sled` con ediciones
+ * secuenciales, al azar y en orden inverso.
+ *
+ * Sobre un archivo de 1.000.000 de líneas inserta y después borra
+ * EDITS líneas siguiendo tres patrones, con el cursor y sin él (se
+ * olvida antes de cada orden). Con el cursor, las ediciones seguidas
+ * caminan uno o dos nodos desde la anterior: O(1) amortizado. Sin él,
+ * cada una baja desde la raíz: O(log n). Al azar el cursor no ayuda.
+ *
+ * Compilar y ejecutar (desde esta carpeta):
+ *   gcc -Wall -Wextra -std=c11 -O2 -pthread -o patrones 25_editor_patrones.c
+ *   ./patrones [líneas]
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define _POSIX_C_SOURCE 200809L /* Para clock_gettime y mkstemp con -std=c11 */
+
+/* El editor entero, con su `main` renombrado para usar el nuestro. */
+#define main sled_main
+#include "../25_editor_texto_simple.c"
+#undef main
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h> /* close, unlink */
+
+#define EDITS 100000 /* Inserciones, y luego otros tantos borrados */
+
+typedef enum { SEQUENTIAL, RANDOM, REVERSE } Pattern;
+
+/* Reloj monótono en nanosegundos. */
+uint64_t bench_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+/* Escribe en `path` un archivo de `lines` líneas de unos 20 bytes. */
+void write_lines(const char *path, long lines)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    for (long i = 1; i <= lines; i++)
+        fprintf(file, "linea de prueba %ld\n", i);
+    fclose(file);
+}
+
+/*
+ * Posición de la inserción o el borrado `i` a partir de la línea
+ * `start`. Secuencial: se inserta cada línea tras la anterior y se borra
+ * siempre en `start` (la siguiente ocupa su lugar). Inverso: se retrocede
+ * una línea en cada orden. Al azar: cualquier línea.
+ */
+int position(Pattern pattern, bool insert, int start, int i)
+{
+    switch (pattern) {
+    case SEQUENTIAL:
+        return insert ? start + i : start;
+    case REVERSE:
+        return start - i;
+    default:
+        return 1 + rand() % line_count;
+    }
+}
+
+/*
+ * Carga `path`, hace las ediciones y devuelve los ns medios por orden
+ * (inserciones y borrados juntos).
+ */
+double run_pattern(const char *path, Pattern pattern, bool cursor)
+{
+    load_file(path);
+    int start = line_count / 2;
+    srand(1);
+    uint64_t elapsed = 0;
+    for (int i = 0; i < EDITS; i++) {
+        int at = position(pattern, true, start, i);
+        if (!cursor)
+            cursor_line = NULL;
+        uint64_t t = bench_ns();
+        insert_line(at, "nueva");
+        elapsed += bench_ns() - t;
+    }
+    for (int i = 0; i < EDITS; i++) {
+        int at = position(pattern, false, start, i);
+        if (!cursor)
+            cursor_line = NULL;
+        uint64_t t = bench_ns();
+        delete_line(at);
+        elapsed += bench_ns() - t;
+    }
+    free_buffer();
+    return (double)elapsed / (2 * EDITS);
+}
+
+int main(int argc, char *argv[])
+{
+    long lines = argc > 1 ? atol(argv[1]) : 1000000;
+    if (lines < 2 * EDITS) {
+        fprintf(stderr, "Hacen falta al menos %d líneas.\n", 2 * EDITS);
+        return 1;
+    }
+    char path[] = "/tmp/sled_patrones_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+    write_lines(path, lines);
+
+    const char *names[] = {"secuencial", "al azar", "inverso"};
+    printf("%ld líneas, %d inserciones y %d borrados por patrón\n", lines,
+           EDITS, EDITS);
+    printf("%-12s %17s %17s\n", "patrón", "con cursor (ns)", "sin cursor (ns)");
+    for (Pattern p = SEQUENTIAL; p <= REVERSE; p++)
+        printf("%-11s %17.0f %17.0f\n", names[p],
+               run_pattern(path, p, true), run_pattern(path, p, false));
+    unlink(path);
+    return 0;
+}
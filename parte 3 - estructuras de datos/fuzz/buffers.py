@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""
+buffers.py - Prueba aleatoria de varios archivos abiertos en `sled`.
+
+Abre tres archivos, más uno que aún no existe (`o` lo empieza vacío y
+`s` lo crea), y mezcla al azar `o` (abrir o volver a uno), `b`
+(cambiar de archivo), `y`/`x` (copiar y pegar, también de un archivo a
+otro), `i`, `d`, `s///`, `u` y `U`. Las mismas órdenes se aplican a un
+modelo en Python: una lista de líneas y una pila de deshacer por archivo
+y un registro común. Al final se guardan todos los archivos abiertos y
+cada uno debe coincidir con su modelo.
+
+Cada semilla se prueba en modo normal y paginado (`-m 1`), con un binario
+compilado con AddressSanitizer y UBSan.
+
+Uso (desde cualquier carpeta):
+    python3 buffers.py [semillas] [órdenes por semilla]
+
+SPDX-License-Identifier: MIT
+"""
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(HERE, "..", "25_editor_texto_simple.c")
+FLAGS = ["-std=c11", "-g", "-O1", "-pthread",
+         "-fsanitize=address,undefined", "-fno-sanitize-recover=all"]
+FILES = 3  # Más uno nuevo, que se borra antes de cada prueba
+
+
+def build(workdir):
+    exe = os.path.join(workdir, "sled")
+    subprocess.run(["gcc", *FLAGS, "-o", exe, SOURCE], check=True)
+    return exe
+
+
+def generate(rng, count, paths):
+    """
+    Escribe los archivos de partida y devuelve las órdenes y el contenido
+    final que debe tener cada archivo abierto.
+    """
+    models = []
+    for path in paths[:FILES]:
+        lines = [f"c{rng.randint(0, 5)}" for _ in range(rng.randint(0, 30))]
+        with open(path, "w") as f:
+            f.write("".join(line + "\n" for line in lines))
+        models.append(lines)
+    for path in paths[FILES:]:
+        if os.path.exists(path):
+            os.unlink(path)
+        models.append([])
+    history = [[] for _ in paths]
+    future = [[] for _ in paths]
+    opened = [0]  # Índices de `paths` en el orden de `b`
+    current = 0
+    register = None
+    commands = []
+
+    def edited(new):
+        history[current].append(models[current])
+        future[current].clear()
+        models[current] = new
+
+    for _ in range(count):
+        r = rng.random()
+        model = models[current]
+        n = len(model)
+        if r < 0.1:
+            k = rng.randrange(len(paths))
+            commands.append(f"o {paths[k]}")
+            if k not in opened:
+                opened.append(k)
+            current = k
+        elif r < 0.2:
+            k = rng.randrange(len(opened))
+            commands.append(f"b {k + 1}")
+            current = opened[k]
+        elif r < 0.35 and n > 0:
+            a = rng.randint(1, n)
+            b = rng.randint(a, min(n, a + 6))
+            commands.append(f"y {a},{b}")
+            register = model[a - 1:b]
+        elif r < 0.5 and register:
+            at = rng.randint(0, n)
+            commands.append(f"x {at}")
+            edited(model[:at] + register + model[at:])
+        elif r < 0.6:
+            k = rng.randint(1, n + 1)
+            text = f"c{rng.randint(0, 5)}"
+            commands.append(f"i {k} {text}")
+            edited(model[:k - 1] + [text] + model[k - 1:])
+        elif r < 0.7 and n > 0:
+            k = rng.randint(1, n)
+            commands.append(f"d {k}")
+            edited(model[:k - 1] + model[k:])
+        elif r < 0.75:
+            commands.append("s/c1/zz/")
+            new = [line.replace("c1", "zz") for line in model]
+            if new != model:  # Sin cambios no hay nada que deshacer
+                edited(new)
+        elif r < 0.9:
+            commands.append("u")
+            if history[current]:
+                future[current].append(model)
+                models[current] = history[current].pop()
+        else:
+            commands.append("U")
+            if future[current]:
+                history[current].append(model)
+                models[current] = future[current].pop()
+    for number in range(1, len(opened) + 1):
+        commands += [f"b {number}", "s"]
+    return commands + ["q"], {k: models[k] for k in opened}
+
+
+def check(command, paths, commands, expected):
+    """Ejecuta las órdenes; devuelve una descripción del fallo o None."""
+    for path in paths:
+        if os.path.exists(path + ".sled-swp"):
+            os.unlink(path + ".sled-swp")
+    run = subprocess.run(command + [paths[0]],
+                         input=("\n".join(commands) + "\n").encode(),
+                         stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    if run.returncode != 0:
+        return f"salida {run.returncode}: {run.stderr.decode()[:500]}"
+    for k, lines in expected.items():
+        with open(paths[k]) as f:
+            if f.read() != "".join(line + "\n" for line in lines):
+                return f"{os.path.basename(paths[k])} no coincide con el modelo"
+    return None
+
+
+def main():
+    seeds = int(sys.argv[1]) if len(sys.argv) > 1 else 20
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        paths = [os.path.join(workdir, f"buffer{k}.txt") for k in range(FILES)]
+        paths.append(os.path.join(workdir, "nuevo.txt"))
+        sled = build(workdir)
+        for seed in range(seeds):
+            for name, command in (("normal", [sled]),
+                                  ("paginado", [sled, "-m", "1"])):
+                commands, expected = generate(random.Random(seed), count,
+                                              paths)
+                problem = check(command, paths, commands, expected)
+                if problem:
+                    print(f"{name}, semilla {seed}: {problem}")
+                    failures += 1
+    print("OK" if failures == 0 else f"{failures} fallos")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""
+carga.py - Prueba aleatoria de la carga en paralelo de `sled`.
+
+Compila el editor con LOAD_PARALLEL_BYTES=1 para que cualquier archivo,
+por pequeño que sea, se indexe con varios hilos, y con 1 a 11 hilos
+fijos (LOAD_THREADS). Con cada binario carga archivos al azar: líneas
+vacías, largas, sin '\\n' final, trozos más cortos que una línea. Después
+comprueba que `p` muestra exactamente las líneas esperadas y que `s`
+las vuelve a escribir (todas con '\\n', también la última).
+
+Uso (desde cualquier carpeta):
+    python3 carga.py [semillas]
+
+SPDX-License-Identifier: MIT
+"""
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(HERE, "..", "25_editor_texto_simple.c")
+FLAGS = ["-std=c11", "-g", "-O1", "-pthread",
+         "-fsanitize=address,undefined", "-fno-sanitize-recover=all"]
+
+
+def build(workdir, threads):
+    """Compila el editor forzando `threads` hilos de carga."""
+    exe = os.path.join(workdir, f"sled_{threads}")
+    subprocess.run(["gcc", *FLAGS, "-DLOAD_PARALLEL_BYTES=1",
+                    f"-DLOAD_THREADS={threads}", "-o", exe, SOURCE],
+                   check=True)
+    return exe
+
+
+def random_file(rng):
+    """Texto al azar: a veces vacío, a veces sin '\\n' al final."""
+    lines = []
+    for _ in range(rng.choice([0, 1, 2, 3, 10, 50, 300])):
+        length = rng.choice([0, 0, 1, 5, 20, 80, 2000])
+        lines.append("".join(rng.choice("abc xyz\t0123") for _ in range(length)))
+    text = "\n".join(lines)
+    if lines and rng.random() < 0.7:
+        text += "\n"
+    return text
+
+
+def expected_lines(text):
+    """Las líneas que el editor debe ver en `text`."""
+    if text == "":
+        return []
+    lines = text.split("\n")
+    if text.endswith("\n"):
+        lines.pop()
+    return lines
+
+
+def check(exe, path, text):
+    """Carga `text` con `exe`; devuelve una descripción del fallo o None."""
+    with open(path, "w") as f:
+        f.write(text)
+    lines = expected_lines(text)
+    # `s` solo guarda si hay cambios: insertamos y borramos una línea.
+    commands = "p\n" if lines else ""
+    commands += "i 1 x\nd 1\ns\nq\n"
+    run = subprocess.run([exe, "-", path], input=commands.encode(),
+                         capture_output=True)
+    if run.returncode != 0 or run.stderr:
+        return f"salida {run.returncode}: {run.stderr.decode()[:500]}"
+
+    shown = run.stdout.decode().split("\n")[:len(lines)]
+    for number, (got, want) in enumerate(zip(shown, lines), 1):
+        if got != f"{number:4d}: {want}":
+            return f"línea {number}: {got!r} en vez de {want!r}"
+    if len(shown) != len(lines):
+        return f"{len(shown)} líneas en vez de {len(lines)}"
+    with open(path) as f:
+        if f.read() != "".join(line + "\n" for line in lines):
+            return "`s` no escribió las mismas líneas"
+    return None
+
+
+def main():
+    seeds = int(sys.argv[1]) if len(sys.argv) > 1 else 200
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        path = os.path.join(workdir, "carga.txt")
+        for threads in range(1, 12):
+            exe = build(workdir, threads)
+            for seed in range(seeds):
+                text = random_file(random.Random(seed))
+                problem = check(exe, path, text)
+                if problem:
+                    print(f"{threads} hilos, semilla {seed}: {problem}")
+                    failures += 1
+    print("OK" if failures == 0 else f"{failures} fallos")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""
+ediciones.py - Prueba aleatoria de las órdenes de edición de `sled`.
+
+Genera miles de órdenes al azar (i, a, d, m, t, s///, sort, uniq, u, U)
+y las aplica a la vez al editor y a un modelo en Python: una lista de
+líneas con su propia pila de deshacer. Al final el editor guarda con `s`
+y el archivo debe coincidir con el modelo.
+
+Cada semilla se prueba con tres configuraciones: normal, paginada
+(`-m 1`) y con la carga repartida entre 7 hilos aunque el archivo sea
+pequeño. Los binarios se compilan con AddressSanitizer y UBSan.
+
+Uso (desde cualquier carpeta):
+    python3 ediciones.py [semillas] [órdenes por semilla]
+
+SPDX-License-Identifier: MIT
+"""
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(HERE, "..", "25_editor_texto_simple.c")
+FLAGS = ["-std=c11", "-g", "-O1", "-pthread",
+         "-fsanitize=address,undefined", "-fno-sanitize-recover=all"]
+
+
+def build(workdir, name, defines=()):
+    """Compila el editor con los `-D` dados."""
+    exe = os.path.join(workdir, name)
+    subprocess.run(["gcc", *FLAGS, *defines, "-o", exe, SOURCE], check=True)
+    return exe
+
+
+def pick_range(rng, n, span):
+    """Un rango [a, b] de como mucho `span` + 1 líneas, o todo el buffer."""
+    if rng.random() < 0.3:
+        return 1, n, True
+    a = rng.randint(1, n)
+    return a, rng.randint(a, min(n, a + span)), False
+
+
+def generate(rng, count):
+    """Devuelve las órdenes y el contenido final que deben producir."""
+    model = [str(i) for i in range(1, 101)]
+    history, future = [], []
+    commands = []
+    fresh = 0
+
+    def edited(old):
+        history.append(old)
+        future.clear()
+
+    for _ in range(count):
+        r = rng.random()
+        n = len(model)
+        old = list(model)
+        if r < 0.2:
+            k = rng.randint(1, n + 1)
+            text = f"n{fresh}"
+            fresh += 1
+            commands.append(f"i {k} {text}")
+            model.insert(k - 1, text)
+            edited(old)
+        elif r < 0.3 and n > 0:
+            k = rng.randint(1, n)
+            commands.append(f"d {k}")
+            del model[k - 1]
+            edited(old)
+        elif r < 0.4 and n > 0:
+            a = rng.randint(1, n)
+            b = rng.randint(a, min(n, a + 5))
+            commands.append(f"d {a},{b}")
+            del model[a - 1:b]
+            edited(old)
+        elif r < 0.5 and n > 0:
+            a = rng.randint(1, n)
+            b = rng.randint(a, min(n, a + 5))
+            dest = rng.randint(0, n)
+            if a <= dest < b:
+                continue  # Destino dentro del rango: el editor lo rechaza
+            commands.append(f"m {a},{b},{dest}")
+            block = model[a - 1:b]
+            rest = model[:a - 1] + model[b:]
+            if dest >= b:
+                dest -= b - a + 1
+            model = rest[:dest] + block + rest[dest:]
+            edited(old)
+        elif r < 0.55 and n > 0:
+            a = rng.randint(1, n)
+            b = rng.randint(a, min(n, a + 5))
+            dest = rng.randint(0, n)
+            commands.append(f"t {a},{b},{dest}")
+            model = model[:dest] + model[a - 1:b] + model[dest:]
+            edited(old)
+        elif r < 0.6:
+            text = f"a{fresh}"
+            fresh += 1
+            commands.append(f"a {text}")
+            model.append(text)
+            edited(old)
+        elif r < 0.65:
+            old_text = rng.choice("0123456789")
+            new_text = rng.choice(["Z", "QQ", ""])
+            commands.append(f"s/{old_text}/{new_text}/")
+            new = [line.replace(old_text, new_text) for line in model]
+            if new != model:  # Sin cambios no hay nada que deshacer
+                model = new
+                edited(old)
+        elif r < 0.72 and n > 0:
+            a, b, whole = pick_range(rng, n, 30)
+            commands.append("sort" if whole else f"sort {a},{b}")
+            new = model[:a - 1] + sorted(model[a - 1:b]) + model[b:]
+            if new != model:
+                model = new
+                edited(old)
+        elif r < 0.76 and n > 0:
+            a, b, whole = pick_range(rng, n, 30)
+            commands.append("uniq" if whole else f"uniq {a},{b}")
+            seen, kept = set(), []
+            for line in model[a - 1:b]:
+                if line not in seen:
+                    seen.add(line)
+                    kept.append(line)
+            new = model[:a - 1] + kept + model[b:]
+            if new != model:
+                model = new
+                edited(old)
+        elif r < 0.85:
+            commands.append("u")
+            if history:
+                future.append(model)
+                model = history.pop()
+        else:
+            commands.append("U")
+            if future:
+                history.append(model)
+                model = future.pop()
+    return commands + ["s", "q"], model
+
+
+def check(command, path, commands, model):
+    """Ejecuta las órdenes; devuelve una descripción del fallo o None."""
+    with open(path, "w") as f:
+        f.write("".join(f"{i}\n" for i in range(1, 101)))
+    run = subprocess.run(command + [path],
+                         input=("\n".join(commands) + "\n").encode(),
+                         stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    if run.returncode != 0:
+        return f"salida {run.returncode}: {run.stderr.decode()[:500]}"
+    with open(path) as f:
+        if f.read() != "".join(line + "\n" for line in model):
+            return "el archivo guardado no coincide con el modelo"
+    return None
+
+
+def main():
+    seeds = int(sys.argv[1]) if len(sys.argv) > 1 else 20
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 3000
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        path = os.path.join(workdir, "ediciones.txt")
+        sled = build(workdir, "sled")
+        threaded = build(workdir, "sled_hilos",
+                         ["-DLOAD_PARALLEL_BYTES=1", "-DLOAD_THREADS=7"])
+        setups = {"normal": [sled], "paginado": [sled, "-m", "1"],
+                  "7 hilos": [threaded]}
+        for seed in range(seeds):
+            commands, model = generate(random.Random(seed), count)
+            for name, command in setups.items():
+                problem = check(command, path, commands, model)
+                if problem:
+                    print(f"{name}, semilla {seed}: {problem}")
+                    failures += 1
+    print("OK" if failures == 0 else f"{failures} fallos")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""
+lectura.py - Prueba aleatoria de `r` (leer otro archivo) en `sled`.
+
+Mezcla al azar `r [n] archivo`, `d`, `i`, `u` y `U` y las aplica a la vez
+al editor y a un modelo en Python con su propia pila de deshacer. Los
+fragmentos que se leen tienen 0, 1, 3, 7, 20 o 200.000 líneas (este
+último se proyecta en vez de copiarse), con y sin '\\n' final.
+
+Cada semilla se prueba en modo normal y paginado (`-m 1`), de dos maneras:
+
+- guardando con `s` y comparando el archivo con el modelo;
+- cortando la sesión sin guardar (fin de la entrada, como Ctrl+D: el
+  diario se queda), BORRANDO los fragmentos y recuperando el diario al
+  volver a abrir: `r` anota el texto leído, no el nombre, así que la
+  recuperación no debe necesitar los fragmentos.
+
+Uso (desde cualquier carpeta):
+    python3 lectura.py [semillas] [órdenes por semilla]
+
+SPDX-License-Identifier: MIT
+"""
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(HERE, "..", "25_editor_texto_simple.c")
+FLAGS = ["-std=c11", "-g", "-O1", "-pthread",
+         "-fsanitize=address,undefined", "-fno-sanitize-recover=all"]
+FRAGMENTS = 5
+
+
+def build(workdir):
+    exe = os.path.join(workdir, "sled")
+    subprocess.run(["gcc", *FLAGS, "-o", exe, SOURCE], check=True)
+    return exe
+
+
+def write_fragments(rng, workdir):
+    """Escribe los fragmentos y devuelve sus rutas y sus líneas."""
+    paths, contents = [], []
+    for k in range(FRAGMENTS):
+        n = rng.choice([0, 1, 3, 20, 200000 if k == FRAGMENTS - 1 else 7])
+        lines = [f"f{k}_{j}" for j in range(n)]
+        text = "\n".join(lines)
+        if lines and rng.random() < 0.7:
+            text += "\n"
+        path = os.path.join(workdir, f"fragmento{k}.txt")
+        with open(path, "w") as f:
+            f.write(text)
+        paths.append(path)
+        contents.append(lines)
+    return paths, contents
+
+
+def generate(rng, count, paths, contents):
+    """Devuelve las órdenes y el contenido final que deben producir."""
+    model = [str(i) for i in range(1, 51)]
+    history, future = [], []
+    commands = []
+    for _ in range(count):
+        r = rng.random()
+        n = len(model)
+        old = list(model)
+        if r < 0.3:
+            k = rng.randrange(FRAGMENTS)
+            if rng.random() < 0.2:
+                commands.append(f"r {paths[k]}")  # Sin número: al final
+                at = n
+            else:
+                at = rng.randint(0, n)
+                commands.append(f"r {at} {paths[k]}")
+            if contents[k]:  # Un archivo vacío no es una edición
+                model = model[:at] + contents[k] + model[at:]
+                history.append(old)
+                future.clear()
+        elif r < 0.45 and n > 0:
+            a = rng.randint(1, n)
+            b = rng.randint(a, min(n, a + 5))
+            commands.append(f"d {a},{b}")
+            del model[a - 1:b]
+            history.append(old)
+            future.clear()
+        elif r < 0.55:
+            k = rng.randint(1, n + 1)
+            commands.append(f"i {k} x")
+            model.insert(k - 1, "x")
+            history.append(old)
+            future.clear()
+        elif r < 0.8:
+            commands.append("u")
+            if history:
+                future.append(model)
+                model = history.pop()
+        else:
+            commands.append("U")
+            if future:
+                history.append(model)
+                model = future.pop()
+    return commands, model
+
+
+def reset(path):
+    """Deja el archivo de partida y sin diarios de sesiones anteriores."""
+    with open(path, "w") as f:
+        f.write("".join(f"{i}\n" for i in range(1, 51)))
+    for name in (path + ".sled-swp", path + ".sled-swp.old"):
+        if os.path.exists(name):
+            os.unlink(name)
+
+
+def run_saved(command, path, commands):
+    """Aplica las órdenes y guarda con `s`."""
+    script = "\n".join(commands + ["s", "q"]) + "\n"
+    run = subprocess.run(command + [path], input=script.encode(),
+                         stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    return run.returncode, run.stderr.decode()
+
+
+def run_crashed(command, path, commands, paths):
+    """
+    Aplica las órdenes sin guardar: al acabarse la entrada la sesión
+    termina y deja el diario. Después borra los fragmentos y recupera el
+    diario en una sesión nueva que guarda con `s`.
+    """
+    subprocess.run(command + [path],
+                   input=("\n".join(commands) + "\n").encode(),
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    for fragment in paths:
+        os.unlink(fragment)
+    run = subprocess.run(command + [path], input=b"s\nq\n",
+                         stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    return run.returncode, run.stderr.decode()
+
+
+def main():
+    seeds = int(sys.argv[1]) if len(sys.argv) > 1 else 10
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 300
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        path = os.path.join(workdir, "lectura.txt")
+        sled = build(workdir)
+        for seed in range(seeds):
+            for name, command in (("normal", [sled]),
+                                  ("paginado", [sled, "-m", "1"])):
+                for crash in (False, True):
+                    rng = random.Random(seed)
+                    paths, contents = write_fragments(rng, workdir)
+                    commands, model = generate(rng, count, paths, contents)
+                    reset(path)
+                    if crash:
+                        status, errors = run_crashed(command, path, commands,
+                                                     paths)
+                    else:
+                        status, errors = run_saved(command, path, commands)
+                    with open(path) as f:
+                        same = f.read() == "".join(l + "\n" for l in model)
+                    if status != 0 or not same:
+                        how = "recuperando" if crash else "guardando"
+                        print(f"{name}, {how}, semilla {seed}: salida "
+                              f"{status}, {'' if same else 'no '}coincide. "
+                              f"{errors[:500]}")
+                        failures += 1
+    print("OK" if failures == 0 else f"{failures} fallos")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
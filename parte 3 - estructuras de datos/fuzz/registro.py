@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""
+registro.py - Prueba aleatoria del registro de alumnos contra un modelo.
+
+Cada semilla alterna sesiones del menú (añadir, buscar, cambiar nombre o
+nota, borrar y guardar, todo en un mismo proceso: el índice crece y el
+montón de nombres se compacta sin volver a cargar) con órdenes sueltas
+de la línea de órdenes (`import`, `find`, `update`, `delete`) sobre el
+`students.db` proyectado. Las mismas operaciones se aplican a un modelo
+en Python, un diccionario de id a (nombre, nota). Cada `find` debe
+mostrar lo que dice el modelo y, tras cada ronda, `export` debe volcar
+exactamente los alumnos del modelo.
+
+Los ids salen de un rango pequeño para que se repitan a menudo. Los
+nombres de `import` y `update` pueden pasar del tope del programa, que
+debe cortarlos como hace el menú. El binario se compila con
+AddressSanitizer y UBSan.
+
+Uso (desde cualquier carpeta):
+    python3 registro.py [semillas] [rondas por semilla]
+
+SPDX-License-Identifier: MIT
+"""
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(HERE, "..", "17_registro_estudiantes.c")
+FLAGS = ["-std=c11", "-g", "-O1",
+         "-fsanitize=address,undefined", "-fno-sanitize-recover=all"]
+MENU_OPS = 150  # Operaciones por sesión del menú
+CLI_OPS = 10    # Órdenes sueltas por ronda
+NAME_MAX = 49   # MAX_NAME_LEN - 1: lo que cabe al teclear en el menú
+
+
+def build(workdir):
+    exe = os.path.join(workdir, "registro")
+    subprocess.run(["gcc", *FLAGS, "-o", exe, SOURCE], check=True)
+    return exe
+
+
+def random_name(rng, longest=40):
+    return "".join(rng.choice("abc xyz,")
+                   for _ in range(rng.randint(1, longest)))
+
+
+def shown(id, name, gpa):
+    """La línea de `print_student` para un alumno."""
+    return f"{id:<4d} | {name:<50s} | {gpa:5.2f}"
+
+
+def run(exe, workdir, args, stdin=b""):
+    """Ejecuta el registro; falla si sale mal o avisan los sanitizers."""
+    result = subprocess.run([exe, *args], cwd=workdir, input=stdin,
+                            capture_output=True)
+    stderr = result.stderr.decode(errors="replace")
+    if "Sanitizer" in stderr or "runtime error" in stderr:
+        raise AssertionError(f"{' '.join(args) or 'menú'}: {stderr[:500]}")
+    return result.returncode, result.stdout.decode(errors="replace")
+
+
+def menu_session(rng, exe, workdir, model, ids):
+    """Una sesión del menú con operaciones al azar; guarda al final."""
+    script = []
+    for _ in range(MENU_OPS):
+        r = rng.random()
+        id = rng.choice(ids)
+        if r < 0.35:
+            script.append(f"1\n{id}\n")
+            if id not in model:
+                name, gpa = random_name(rng), rng.randint(0, 16) / 4
+                script.append(f"{name}\n{gpa}\n")
+                model[id] = (name, gpa)
+        elif r < 0.5:
+            script.append(f"3\n{id}\n")
+        elif r < 0.75:
+            script.append(f"4\n{id}\n")
+            if id in model:
+                name, gpa = model[id]
+                new_name = random_name(rng) if rng.random() < 0.7 else ""
+                new_gpa = str(rng.randint(0, 16) / 4) \
+                    if rng.random() < 0.5 else ""
+                script.append(f"{new_name}\n{new_gpa}\n")
+                model[id] = (new_name or name,
+                             float(new_gpa) if new_gpa else gpa)
+        else:
+            script.append(f"5\n{id}\n")
+            model.pop(id, None)
+    script.append("6\n9\n")
+    status, output = run(exe, workdir, [], "".join(script).encode())
+    if status != 0:
+        raise AssertionError(f"menú: salida {status}: {output[-500:]}")
+
+
+def cli_round(rng, exe, workdir, model, ids):
+    """Órdenes sueltas sobre el fichero proyectado."""
+    for _ in range(CLI_OPS):
+        r = rng.random()
+        id = rng.choice(ids)
+        existed = id in model
+        if r < 0.2:
+            csv = os.path.join(workdir, "nuevos.csv")
+            with open(csv, "w") as f:
+                for _ in range(rng.randint(1, 5)):
+                    new_id = rng.choice(ids)
+                    name, gpa = random_name(rng, 70), rng.randint(0, 16) / 4
+                    f.write(f"{new_id},{name},{gpa}\n")
+                    if new_id not in model:  # Los repetidos se rechazan
+                        model[new_id] = (name[:NAME_MAX], gpa)
+            status, output = run(exe, workdir, ["import", csv])
+            existed = True  # `import` siempre debe salir bien
+        elif r < 0.5:
+            status, output = run(exe, workdir, ["find", str(id)])
+            if existed and shown(id, *model[id]) not in output:
+                raise AssertionError(f"find {id}: {output[-300:]}")
+        elif r < 0.8:
+            name = random_name(rng, 70) if rng.random() < 0.7 else "-"
+            gpa = str(rng.randint(0, 16) / 4) if rng.random() < 0.5 else "-"
+            status, output = run(exe, workdir, ["update", str(id), name, gpa])
+            if existed:
+                old_name, old_gpa = model[id]
+                model[id] = (old_name if name == "-" else name[:NAME_MAX],
+                             old_gpa if gpa == "-" else float(gpa))
+        else:
+            status, output = run(exe, workdir, ["delete", str(id)])
+            model.pop(id, None)
+        if status != (0 if existed else 1):
+            raise AssertionError(f"salida {status}: {output[-300:]}")
+
+
+def check_export(exe, workdir, model):
+    """`export` debe volcar exactamente los alumnos del modelo."""
+    out = os.path.join(workdir, "salida.csv")
+    status, output = run(exe, workdir, ["export", out])
+    if status != 0:
+        raise AssertionError(f"export: salida {status}: {output[-300:]}")
+    got = {}
+    with open(out) as f:
+        for line in f:
+            first, last = line.index(","), line.rindex(",")
+            got[int(line[:first])] = (line[first + 1:last],
+                                      line[last + 1:].strip())
+    want = {id: (name, f"{gpa:.2f}") for id, (name, gpa) in model.items()}
+    if got != want:
+        raise AssertionError(f"export: {len(got)} alumnos, el modelo "
+                             f"tiene {len(want)}")
+
+
+def main():
+    seeds = int(sys.argv[1]) if len(sys.argv) > 1 else 80
+    rounds = int(sys.argv[2]) if len(sys.argv) > 2 else 4
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        exe = build(workdir)
+        db = os.path.join(workdir, "students.db")
+        for seed in range(seeds):
+            rng = random.Random(seed)
+            top = rng.choice([5, 20, 100])
+            ids = list(range(-top // 4, top))
+            model = {}
+            if os.path.exists(db):
+                os.unlink(db)
+            try:
+                for _ in range(rounds):
+                    menu_session(rng, exe, workdir, model, ids)
+                    check_export(exe, workdir, model)
+                    cli_round(rng, exe, workdir, model, ids)
+                    check_export(exe, workdir, model)
+            except AssertionError as problem:
+                print(f"semilla {seed}: {problem}")
+                failures += 1
+    print("OK" if failures == 0 else f"{failures} fallos")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
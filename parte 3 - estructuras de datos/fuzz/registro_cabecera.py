@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""
+registro_cabecera.py - Prueba de `students.db` truncados o dañados.
+
+Crea un `students.db` válido importando un CSV al azar y, en cada caso,
+lo estropea de una manera: lo corta en cualquier punto, cambia bytes de
+la cabecera, pone en un campo de la cabecera (número de alumnos,
+desplazamientos, tamaño del montón) un valor extremo o al azar, apunta
+nombres fuera del montón o quita el '\\0' final. Después ejecuta
+`registro export` con un binario compilado con AddressSanitizer y UBSan.
+
+El programa debe rechazar el fichero con un error (salida 1) o cargarlo
+de forma coherente: sin avisos de los sanitizers y exportando tantas
+líneas como alumnos dice haber cargado.
+
+Uso (desde cualquier carpeta):
+    python3 registro_cabecera.py [casos]
+
+SPDX-License-Identifier: MIT
+"""
+import os
+import random
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SOURCE = os.path.join(HERE, "..", "17_registro_estudiantes.c")
+FLAGS = ["-std=c11", "-g", "-O1",
+         "-fsanitize=address,undefined", "-fno-sanitize-recover=all"]
+HEADER = struct.Struct("=8sII6Q")  # DbHeader: 64 bytes
+FIELDS = ["count", "ids_offset", "gpas_offset", "name_offsets_offset",
+          "names_offset", "names_len"]
+EXTREMES = [0, 1, 7, 8, 63, 64, 2**31, 2**32, 2**63, 2**64 - 1, 2**64 - 8]
+
+
+def build(workdir):
+    exe = os.path.join(workdir, "registro")
+    subprocess.run(["gcc", *FLAGS, "-o", exe, SOURCE], check=True)
+    return exe
+
+
+def make_database(exe, workdir, rng):
+    """Importa un CSV al azar y devuelve el `students.db` resultante."""
+    csv = os.path.join(workdir, "alumnos.csv")
+    with open(csv, "w") as f:
+        for i in range(rng.randint(1, 60)):
+            name = "".join(rng.choice("abc ,xyz")
+                           for _ in range(rng.randint(1, 30)))
+            f.write(f"{i},{name},{rng.uniform(0, 4):.3f}\n")
+    db = os.path.join(workdir, "students.db")
+    if os.path.exists(db):
+        os.unlink(db)
+    subprocess.run([exe, "import", csv], cwd=workdir, check=True,
+                   stdout=subprocess.DEVNULL)
+    with open(db, "rb") as f:
+        return f.read()
+
+
+def damage(data, rng):
+    """Devuelve `data` estropeado de una manera al azar."""
+    data = bytearray(data)
+    header = list(HEADER.unpack_from(data))
+    how = rng.randrange(5)
+    if how == 0:
+        return bytes(data[:rng.randrange(len(data))])
+    if how == 1:
+        for _ in range(rng.randint(1, 4)):
+            data[rng.randrange(HEADER.size)] = rng.randrange(256)
+        return bytes(data)
+    if how == 2:
+        field = rng.randrange(len(FIELDS))
+        value = rng.choice(EXTREMES + [rng.randrange(2**64),
+                                       rng.randrange(len(data) + 64)])
+        header[3 + field] = value
+        HEADER.pack_into(data, 0, *header)
+        return bytes(data)
+    if how == 3:
+        count, offsets = header[3], header[6]
+        if count > 0:
+            row = rng.randrange(count)
+            value = rng.choice(EXTREMES + [header[8] - 1, header[8]])
+            struct.pack_into("=Q", data, offsets + 8 * row, value)
+        return bytes(data)
+    data[header[7] + header[8] - 1] = ord("x")  # Sin '\0' al final
+    return bytes(data)
+
+
+def check(exe, workdir, data):
+    """Exporta `data`; devuelve una descripción del fallo o None."""
+    with open(os.path.join(workdir, "students.db"), "wb") as f:
+        f.write(data)
+    out = os.path.join(workdir, "salida.csv")
+    if os.path.exists(out):
+        os.unlink(out)
+    run = subprocess.run([exe, "export", out], cwd=workdir,
+                         capture_output=True)
+    stdout = run.stdout.decode(errors="replace")
+    stderr = run.stderr.decode(errors="replace")
+    if run.returncode not in (0, 1) or "Sanitizer" in stderr or \
+       "runtime error" in stderr:
+        return f"salida {run.returncode}: {stderr[:500]}"
+    if run.returncode == 1:
+        return None if "Error" in stderr else f"salida 1 sin error: {stdout}"
+    loaded = re.search(r"(?:loaded|Imported) (\d+) record", stdout)
+    with open(out, "rb") as f:
+        lines = f.read().count(b"\n")
+    if loaded is None or int(loaded.group(1)) != lines:
+        return f"{lines} líneas exportadas; {stdout[:300]}"
+    return None
+
+
+def main():
+    cases = int(sys.argv[1]) if len(sys.argv) > 1 else 400
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        exe = build(workdir)
+        rng = random.Random(1)
+        for case in range(cases):
+            if case % 20 == 0:
+                original = make_database(exe, workdir, rng)
+            problem = check(exe, workdir, damage(original, rng))
+            if problem:
+                print(f"caso {case}: {problem}")
+                failures += 1
+    print("OK" if failures == 0 else f"{failures} fallos")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())